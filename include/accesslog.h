@@ -0,0 +1,193 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+/**
+ * File Name  : accesslog.h
+ *
+ * Description: Ring buffer of the last requests served, for diagnosing
+ *              slow pages
+ *
+ * Every request adds a fixed-size binary record; adding one takes no
+ * locks and no allocations, so it can stay on in the field. The ring can
+ * be dumped to a file, also from a signal handler, or into memory. A dump
+ * is an AccessLogHeader followed by the records from oldest to newest,
+ * in the byte order of the device; accesscsv converts it to CSV.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define ACCESSLOG_RECORDS       1024            // a power of two
+#define ACCESSLOG_NAME_LEN      96              // last bytes of the name, with '\0'
+#define ACCESSLOG_MAGIC         0x4c41425au     // "ZBAL" in little endian
+#define ACCESSLOG_VERSION       1
+#define ACCESSLOG_DUMP_NAME     "access.bin"    // in the user cache directory
+
+// AccessRecord.flags
+#define ACCESS_HEAD             0x01            // HEAD request
+#define ACCESS_RANGE            0x02            // byte ranges requested
+#define ACCESS_IN_PROCESS       0x04            // read through server_read_entry()
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+// Where the response came from
+typedef enum
+        {
+            ACCESS_NONE = 0,            // no entry: errors, redirects, statistics
+            ACCESS_INDEX,               // the archive index, as for HEAD and 304
+            ACCESS_HOT,                 // a response kept for reuse
+            ACCESS_CACHE,               // the entry cache
+            ACCESS_SPILL,               // a spill file
+            ACCESS_WORKER               // read by a worker
+        } AccessSource;
+
+// Header of a dump, 12 bytes
+typedef struct
+        {
+            guint32     magic;          // ACCESSLOG_MAGIC
+            guint16     version;        // ACCESSLOG_VERSION
+            guint16     record_size;    // sizeof(AccessRecord)
+            guint32     requests;       // logged since the start, including overwritten ones
+        } AccessLogHeader;
+
+// A request, 128 bytes without padding; accesscsv reads it field by field
+typedef struct
+        {
+            guint32     seq;            // number of the request, from 1
+            guint32     time_s;         // when it arrived
+            guint32     time_us;
+            guint32     duration_us;    // until the response was queued
+            guint64     size;           // of the response body
+            guint32     archive_id;     // see archive_get_id(), 0 for none
+            guint16     status;         // HTTP status
+            guint8      source;         // AccessSource
+            guint8      flags;          // ACCESS_HEAD, ...
+            gchar       name[ACCESSLOG_NAME_LEN];   // entry name, or URL
+        } AccessRecord;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  accesslog_init
+ *
+ * @brief  Prepare the file accesslog_dump() writes; records are added
+ *         without it
+ *
+ * @param  [in] path - dump file, NULL for ACCESSLOG_DUMP_NAME in the user
+ *                     cache directory
+ *
+ * @return TRUE when its directory exists, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean accesslog_init ( const gchar *path );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  accesslog_add
+ *
+ * @brief  Add a request to the ring, overwriting the oldest one when it is
+ *         full; may be called from any thread
+ *
+ * @param  [in] name       - entry name or URL; the last bytes are kept
+ * @param  [in] archive_id - archive of the entry, 0 for none
+ * @param  [in] status     - HTTP status of the response
+ * @param  [in] source     - where the response came from
+ * @param  [in] flags      - ACCESS_HEAD, ACCESS_RANGE, ACCESS_IN_PROCESS
+ * @param  [in] size       - size of the response body
+ * @param  [in] start      - stats_get_time() when the request arrived
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void accesslog_add ( const gchar  *name,
+                     guint        archive_id,
+                     guint        status,
+                     AccessSource source,
+                     guint        flags,
+                     guint64      size,
+                     gint64       start );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  accesslog_dump
+ *
+ * @brief  Write the ring to the dump file, replacing it; uses only
+ *         async-signal-safe calls, so a signal handler may call it
+ *
+ * @param  --
+ *
+ * @return TRUE when written, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean accesslog_dump ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  accesslog_get_dump
+ *
+ * @brief  Get the ring in the format of the dump file
+ *
+ * @param  --
+ *
+ * @return Newly allocated dump, to be freed with g_byte_array_free()
+ *
+ *--------------------------------------------------------------------------*/
+GByteArray *accesslog_get_dump ( void );
+
+
+G_END_DECLS
+
+#endif /* __ACCESSLOG_H__ */
@@ -0,0 +1,251 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+/**
+ * File Name  : archive.h
+ *
+ * Description: Registry of the archives served, with an index of their
+ *              entries
+ *
+ * An archive is indexed once from its central directory and then shared,
+ * reference counted, by all HTTP and worker threads. The index is
+ * read-only once built, except for the seek points of large entries,
+ * which are guarded by a per-archive lock. The content type of every entry
+ * is looked up while indexing. An archive whose size or
+ * modification time changed on disk is indexed again on its next use.
+ * The registry keeps a few recently used archives open.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+#include "seekindex.h"
+#include "unzip.h"
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define ARCHIVE_DEFAULT_OPEN    4       // archives kept indexed
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct _Archive Archive;
+
+typedef struct
+        {
+            unz_file_pos    pos;        // for unzGoToFilePos()
+            guint64         size;       // uncompressed size
+            guint           method;     // compression method
+            gboolean        indexed;    // seek points have been recorded
+            const gchar     *content_type; // by extension or maff index.rdf, or NULL
+            guint32         crc;        // CRC-32 of the uncompressed data
+            guint32         dos_date;   // last modification, in MS-DOS format
+            gboolean        encrypted;  // data cannot be read from the file as is
+        } ArchiveEntryInfo;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_init
+ *
+ * @brief  Initialise the archive registry
+ *
+ * @param  [in] max_open - number of unused archives kept indexed
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void archive_init ( guint max_open );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_destroy
+ *
+ * @brief  Empty the registry; archives still referenced are freed when
+ *         their last reference is dropped
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void archive_destroy ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_open
+ *
+ * @brief  Get an archive from the registry, indexing it when it is not
+ *         there yet or has changed on disk. Cached entries of an archive
+ *         are invalidated whenever it is indexed. Safe to call from any
+ *         thread.
+ *
+ * @param  [in] path - absolute path of the archive
+ *
+ * @return New reference to the archive, or NULL when it cannot be opened
+ *
+ *--------------------------------------------------------------------------*/
+Archive *archive_open ( const gchar *path );
+
+
+Archive     *archive_ref      ( Archive *archive );
+void         archive_unref    ( Archive *archive );
+const gchar *archive_get_path ( const Archive *archive );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_get_id
+ *
+ * @brief  Identify one indexing of an archive, e.g. to tell whether an
+ *         unzFile opened earlier still matches it
+ *
+ * @param  [in] archive - archive
+ *
+ * @return Number unique to this process
+ *
+ *--------------------------------------------------------------------------*/
+guint archive_get_id ( const Archive *archive );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_get_version
+ *
+ * @brief  Identify the contents of an archive across runs, from its size
+ *         and modification time on disk
+ *
+ * @param  [in] archive - archive
+ *
+ * @return Token of hex digits and '-', owned by the archive
+ *
+ *--------------------------------------------------------------------------*/
+const gchar *archive_get_version ( const Archive *archive );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_get_file_stat
+ *
+ * @brief  Get the size and modification time of the archive file when it
+ *         was indexed
+ *
+ * @param  [in]  archive - archive
+ * @param  [out] size    - size in bytes
+ * @param  [out] mtime   - modification time, in seconds since the epoch
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void archive_get_file_stat ( const Archive *archive, guint64 *size, gint64 *mtime );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_resolve
+ *
+ * @brief  Map a request path to an entry; a path ending in '/' is resolved
+ *         to the default page of that directory
+ *
+ * @param  [in]  archive - archive
+ * @param  [in]  path    - path inside the archive, with a leading '/'
+ * @param  [out] info    - where the entry is and what it holds
+ *
+ * @return Name of the entry, owned by the archive, or NULL if not found
+ *
+ *--------------------------------------------------------------------------*/
+const gchar *archive_resolve ( Archive *archive, const gchar *path, ArchiveEntryInfo *info );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_set_seek
+ *
+ * @brief  Store the seek points recorded for an entry
+ *
+ * @param  [in] archive - archive
+ * @param  [in] name    - name of the entry
+ * @param  [in] seek    - seek points, owned by the archive from now on;
+ *                        freed when the entry already has some
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void archive_set_seek ( Archive *archive, const gchar *name, SeekIndex *seek );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  archive_read_indexed
+ *
+ * @brief  Decompress part of an entry from the seek point closest before
+ *         offset, see seekindex_read()
+ *
+ * @param  [in]  archive - archive
+ * @param  [in]  name    - name of the entry
+ * @param  [in]  offset  - offset in the uncompressed entry
+ * @param  [out] buf     - receives the data
+ * @param  [in]  len     - number of bytes to read
+ *
+ * @return Number of bytes read, or -1 on error or when the entry has no
+ *         seek points
+ *
+ *--------------------------------------------------------------------------*/
+gssize archive_read_indexed ( Archive      *archive,
+                              const gchar  *name,
+                              guint64      offset,
+                              guchar       *buf,
+                              gsize        len );
+
+
+G_END_DECLS
+
+#endif /* __ARCHIVE_H__ */
@@ -0,0 +1,224 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+/**
+ * File Name  : cache.h
+ *
+ * Description: In-memory cache of decompressed archive entries
+ *
+ * Entries are keyed by (archive, version, entry name) and kept in least-recently-used
+ * order within a fixed byte budget. Entry buffers are reference counted, so
+ * a buffer that is evicted while it is still being sent by the HTTP server
+ * is only freed once the last user drops its reference.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define CACHE_DEFAULT_SIZE      (8 * 1024 * 1024)   // in bytes
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct _CacheEntry CacheEntry;
+
+typedef struct
+        {
+            guint64     hits;           // lookups answered from the cache
+            guint64     misses;         // lookups not in the cache
+            guint64     insertions;     // entries added to the cache
+            guint64     evictions;      // entries dropped to stay within budget
+            guint64     rejected;       // entries larger than the whole budget
+            gsize       bytes_used;     // decompressed bytes currently cached
+            gsize       budget;         // maximum number of cached bytes
+            guint       entries;        // number of entries currently cached
+        } CacheStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_init
+ *
+ * @brief  Initialise the entry cache
+ *
+ * @param  [in] budget - maximum number of decompressed bytes to keep,
+ *                       0 disables caching
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void cache_init ( gsize budget );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_destroy
+ *
+ * @brief  Drop all cached entries; buffers still in use are freed when
+ *         their last reference is released
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void cache_destroy ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_lookup
+ *
+ * @brief  Find a decompressed entry and mark it most recently used
+ *
+ * @param  [in] archive - path of the archive
+ * @param  [in] version - version of its contents, see archive_get_version()
+ * @param  [in] name    - name of the entry inside the archive
+ *
+ * @return New reference to the entry, or NULL on a cache miss
+ *
+ *--------------------------------------------------------------------------*/
+CacheEntry *cache_lookup ( const gchar *archive, const gchar *version, const gchar *name );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_entry_new
+ *
+ * @brief  Allocate an entry with room for size decompressed bytes;
+ *         fill it through cache_entry_get_data() and call cache_insert()
+ *
+ * @param  [in] archive - path of the archive
+ * @param  [in] version - version of its contents, see archive_get_version()
+ * @param  [in] name    - name of the entry inside the archive
+ * @param  [in] size    - uncompressed size of the entry
+ *
+ * @return Entry with a reference count of one, or NULL when out of memory
+ *
+ *--------------------------------------------------------------------------*/
+CacheEntry *cache_entry_new ( const gchar *archive,
+                              const gchar *version,
+                              const gchar *name,
+                              gsize size );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_insert
+ *
+ * @brief  Add a filled entry to the cache, evicting least recently used
+ *         entries until it fits. The caller keeps its own reference.
+ *
+ * @param  [in] entry - entry returned by cache_entry_new()
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void cache_insert ( CacheEntry *entry );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_invalidate_archive
+ *
+ * @brief  Remove the entries of an archive, e.g. when it has changed
+ *
+ * @param  [in] archive - path of the archive
+ * @param  [in] version - version of its contents, NULL for all versions
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void cache_invalidate_archive ( const gchar *archive, const gchar *version );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_can_hold
+ *
+ * @brief  Check whether an entry of the given size may be cached at all
+ *
+ * @param  [in] size - uncompressed size of the entry
+ *
+ * @return TRUE when size is within the cache budget, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean cache_can_hold ( gsize size );
+
+
+CacheEntry *cache_entry_ref       ( CacheEntry *entry );
+void        cache_entry_unref     ( CacheEntry *entry );
+guchar     *cache_entry_get_data  ( CacheEntry *entry );
+gsize       cache_entry_get_size  ( const CacheEntry *entry );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  cache_entry_from_data
+ *
+ * @brief  Map a buffer returned by cache_entry_get_data() back to its entry,
+ *         for free callbacks that only receive the buffer pointer
+ *
+ * @param  [in] data - start of the entry data
+ *
+ * @return The entry owning the buffer
+ *
+ *--------------------------------------------------------------------------*/
+CacheEntry *cache_entry_from_data ( gpointer data );
+
+
+void cache_get_stats ( CacheStats *stats );
+
+
+G_END_DECLS
+
+#endif /* __CACHE_H__ */
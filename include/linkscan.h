@@ -0,0 +1,115 @@
+#ifndef __LINKSCAN_H__
+#define __LINKSCAN_H__
+
+/**
+ * File Name  : linkscan.h
+ *
+ * Description: Streaming scanner for the references of HTML and CSS
+ *
+ * Picks src= and href= attribute values, url() and @import targets out of
+ * a document fed in chunks of any size, without parsing it; good enough to
+ * guess what the browser will request next.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define LINKSCAN_MAX_LINK       1024    // longer references are skipped
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct _LinkScanner LinkScanner;
+
+// Receives a reference as written in the document, still escaped;
+// return FALSE to ignore the rest of the document
+typedef gboolean (*LinkScanFunc) (const gchar *link, gpointer user_data);
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  linkscan_new
+ *
+ * @brief  Create a scanner for one document
+ *
+ * @param  [in] func      - called for every reference found
+ * @param  [in] user_data - passed to func
+ *
+ * @return New scanner, to be freed with linkscan_free()
+ *
+ *--------------------------------------------------------------------------*/
+LinkScanner *linkscan_new ( LinkScanFunc func, gpointer user_data );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  linkscan_feed
+ *
+ * @brief  Scan the next part of the document; a reference split over two
+ *         parts is reported once the second is fed
+ *
+ * @param  [in] scanner - scanner
+ * @param  [in] data    - next bytes of the document
+ * @param  [in] len     - number of bytes
+ *
+ * @return FALSE once func has asked to stop, TRUE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean linkscan_feed ( LinkScanner *scanner, const guchar *data, gsize len );
+
+
+void linkscan_free ( LinkScanner *scanner );
+
+
+G_END_DECLS
+
+#endif /* __LINKSCAN_H__ */
@@ -0,0 +1,64 @@
+/*
+ * File Name  : mime-table.h
+ *
+ * Description: Content types by file extension, generated by mimegen;
+ *              do not edit
+ */
+
+#define MIME_SEED       0x000247fcu
+#define MIME_SLOT_BITS  7
+#define MIME_MAX_EXT    8
+
+static const MimeType mime_table[1 << MIME_SLOT_BITS] =
+{
+    [  1] = { "ncx",      "application/x-dtbncx+xml" },
+    [  3] = { "webp",     "image/webp" },
+    [  6] = { "xht",      "application/xhtml+xml" },
+    [  7] = { "xhtml",    "application/xhtml+xml" },
+    [  9] = { "bmp",      "image/bmp" },
+    [ 10] = { "webm",     "video/webm" },
+    [ 11] = { "epub",     "application/epub+zip" },
+    [ 12] = { "js",       "application/javascript" },
+    [ 13] = { "xml",      "application/xml" },
+    [ 15] = { "tiff",     "image/tiff" },
+    [ 20] = { "text",     "text/plain" },
+    [ 26] = { "ico",      "image/x-icon" },
+    [ 32] = { "rdf",      "application/rdf+xml" },
+    [ 35] = { "json",     "application/json" },
+    [ 37] = { "woff",     "font/woff" },
+    [ 41] = { "otf",      "font/otf" },
+    [ 42] = { "pdf",      "application/pdf" },
+    [ 47] = { "oga",      "audio/ogg" },
+    [ 48] = { "ogg",      "audio/ogg" },
+    [ 52] = { "manifest", "text/cache-manifest" },
+    [ 55] = { "ogv",      "video/ogg" },
+    [ 63] = { "html",     "text/html" },
+    [ 64] = { "mml",      "application/mathml+xml" },
+    [ 65] = { "opf",      "application/oebps-package+xml" },
+    [ 67] = { "png",      "image/png" },
+    [ 68] = { "css",      "text/css" },
+    [ 69] = { "csv",      "text/csv" },
+    [ 71] = { "dtd",      "application/xml-dtd" },
+    [ 72] = { "shtml",    "text/html" },
+    [ 73] = { "mjs",      "application/javascript" },
+    [ 77] = { "m4a",      "audio/mp4" },
+    [ 81] = { "ttf",      "font/ttf" },
+    [ 82] = { "tif",      "image/tiff" },
+    [ 86] = { "appcache", "text/cache-manifest" },
+    [ 88] = { "txt",      "text/plain" },
+    [ 90] = { "xslt",     "application/xslt+xml" },
+    [ 92] = { "jpg",      "image/jpeg" },
+    [ 93] = { "jpe",      "image/jpeg" },
+    [ 94] = { "jpeg",     "image/jpeg" },
+    [ 95] = { "svg",      "image/svg+xml" },
+    [102] = { "swf",      "application/x-shockwave-flash" },
+    [105] = { "mp3",      "audio/mpeg" },
+    [106] = { "zip",      "application/zip" },
+    [107] = { "mp4",      "video/mp4" },
+    [113] = { "htm",      "text/html" },
+    [116] = { "gif",      "image/gif" },
+    [122] = { "woff2",    "font/woff2" },
+    [123] = { "xsl",      "application/xslt+xml" },
+    [124] = { "wav",      "audio/wav" },
+    [125] = { "eot",      "application/vnd.ms-fontobject" },
+};
@@ -0,0 +1,83 @@
+#ifndef __MIME_H__
+#define __MIME_H__
+
+/**
+ * File Name  : mime.h
+ *
+ * Description: Content types of archive entries, by file extension
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  mime_from_name
+ *
+ * @brief  Look up the content type of a file name by its extension, in a
+ *         table without collisions generated by mimegen
+ *
+ * @param  [in] name - file name, possibly with directories
+ *
+ * @return Static content type, or NULL when the extension is unknown
+ *
+ *--------------------------------------------------------------------------*/
+const gchar *mime_from_name ( const gchar *name );
+
+
+G_END_DECLS
+
+#endif /* __MIME_H__ */
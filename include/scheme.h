@@ -0,0 +1,107 @@
+#ifndef __SCHEME_H__
+#define __SCHEME_H__
+
+/**
+ * File Name  : scheme.h
+ *
+ * Description: zip: URI scheme, serving archive entries to the web view
+ *              in-process
+ *
+ * A zip: URI names an entry the same way the HTTP server does, as
+ * zip://<archive path>/__FILES/<entry name>. It is loaded through libsoup
+ * straight from the entry cache, a spill file or a decompression worker,
+ * without a loopback socket or HTTP headers in between. zip:///__STATS
+ * and zip:///__ACCESSLOG give the diagnostics of server.h.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define SCHEME_NAME             "zip"
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  scheme_init
+ *
+ * @brief  Register the zip: scheme with a session; the entries are read
+ *         through server_read_entry(), so the server must be started too
+ *
+ * @param  [in] session - session of the web view
+ *
+ * @return TRUE when registered, FALSE when libsoup has no request API
+ *
+ *--------------------------------------------------------------------------*/
+gboolean scheme_init ( SoupSession *session );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  scheme_get_uri
+ *
+ * @brief  Build the zip: URI of the default page of an archive
+ *
+ * @param  [in] archive - absolute path of the archive
+ *
+ * @return Newly allocated URI, to be freed with g_free()
+ *
+ *--------------------------------------------------------------------------*/
+gchar *scheme_get_uri ( const gchar *archive );
+
+
+G_END_DECLS
+
+#endif /* __SCHEME_H__ */
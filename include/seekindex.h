@@ -0,0 +1,133 @@
+#ifndef __SEEKINDEX_H__
+#define __SEEKINDEX_H__
+
+/**
+ * File Name  : seekindex.h
+ *
+ * Description: Random-access index points inside deflated archive entries
+ *
+ * While a large deflated entry is decompressed from start to end, the
+ * inflate state is recorded at a block boundary about every span bytes of
+ * output: the position in the compressed data and the 32 KiB of output
+ * preceding it. Reading from an arbitrary offset of the entry can then
+ * start decompression at the nearest index point instead of at the start
+ * of the entry (see zlib's examples/zran.c).
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+#include "unzip.h"
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define SEEKINDEX_DEFAULT_SPAN  (1024 * 1024)   // output bytes between index points
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct _SeekIndex SeekIndex;
+
+// Receives the decompressed data while an index is built;
+// return FALSE to stop building
+typedef gboolean (*SeekIndexSink) (const guchar *data, gsize len, gpointer user_data);
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  seekindex_build
+ *
+ * @brief  Decompress the current file of an archive and record index points.
+ *         The current file must be a deflated entry opened in raw mode with
+ *         unzOpenCurrentFile2(); it is not closed by this call. The data is
+ *         checked against the CRC of the entry.
+ *
+ * @param  [in] zip       - archive with the raw current file
+ * @param  [in] span      - minimum number of output bytes between points
+ * @param  [in] sink      - receives the decompressed data, may be NULL
+ * @param  [in] user_data - passed to sink
+ *
+ * @return New index, or NULL when the entry is corrupt or the sink failed
+ *
+ *--------------------------------------------------------------------------*/
+SeekIndex *seekindex_build ( unzFile zip, gsize span, SeekIndexSink sink, gpointer user_data );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  seekindex_read
+ *
+ * @brief  Decompress part of an indexed entry, starting at the index point
+ *         closest before offset
+ *
+ * @param  [in]  index   - index of the entry
+ * @param  [in]  archive - path of the archive the index was built from
+ * @param  [in]  offset  - offset in the uncompressed entry
+ * @param  [out] buf     - receives the data
+ * @param  [in]  len     - number of bytes to read
+ *
+ * @return Number of bytes read, less than len at the end of the entry,
+ *         or -1 on error
+ *
+ *--------------------------------------------------------------------------*/
+gssize seekindex_read ( const SeekIndex *index,
+                        const gchar     *archive,
+                        guint64         offset,
+                        guchar          *buf,
+                        gsize           len );
+
+
+void    seekindex_free        ( SeekIndex *index );
+guint64 seekindex_get_size    ( const SeekIndex *index );
+guint   seekindex_get_points  ( const SeekIndex *index );
+
+
+G_END_DECLS
+
+#endif /* __SEEKINDEX_H__ */
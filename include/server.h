@@ -0,0 +1,239 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+/**
+ * File Name  : server.h
+ *
+ * Description: Embedded HTTP server serving the entries of zip and maff
+ *              archives to the web view
+ *
+ * An entry is requested as <archive path>/__FILES/<entry name>; a name
+ * ending in '/' is resolved to the default page of that directory. The
+ * same entries can be read in-process with server_read_entry().
+ *
+ * Over HTTP, entries are served under <archive path>/__FILES/__V<version>/
+ * only, with the version of the archive contents; other URLs redirect
+ * there. Responses can then be cached as immutable. Byte ranges are
+ * served without decompressing the entire entry where the data allows.
+ *
+ * /__STATS answers with the counters of the caches, workers and server
+ * and the latency histograms of stats.h, as JSON; /__ACCESSLOG with a
+ * dump of the last requests, see accesslog.h. Both are also served
+ * in-process, by server_get_diagnostics(), so zip:///__STATS and
+ * zip:///__ACCESSLOG work when the HTTP daemon is not running.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+#include "cache.h"
+#include "verify.h"
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define SERVER_DEFAULT_PORT     7766
+#define SERVER_DEFAULT_THREADS  1       // one thread polling all connections
+#define SERVER_DEFAULT_CONNECTIONS  64  // WebKit opens several per page
+#define SERVER_DEFAULT_CONN_MEMORY  (32 * 1024)
+#define SERVER_DEFAULT_TIMEOUT      30  // seconds an idle keep-alive connection stays
+#define SERVER_DEFAULT_BACKLOG      64
+#define SERVER_FILES_MARKER     "/__FILES/"
+#define SERVER_STATS_URL        "/__STATS"
+#define SERVER_ACCESSLOG_URL    "/__ACCESSLOG"
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct
+        {
+            guint16     port;               // TCP port on the loopback interface
+            gsize       cache_size;         // decompressed entry cache, in bytes
+            const gchar *spill_dir;         // directory for large decompressed entries
+            gsize       spill_size;         // limit of the spill directory, in bytes
+            VerifyMode  crc_mode;           // when entry CRCs are checked
+            const gchar *password;          // for AES encrypted entries, or NULL
+            guint       threads;            // HTTP threads, each polling its own connections
+            gboolean    main_loop;          // poll from the GLib main loop instead of a thread
+            gboolean    http;               // listen on port; FALSE for in-process reads only
+            guint       connection_limit;   // concurrent connections, 0 for the MHD default
+            gsize       connection_memory;  // per connection, in bytes, 0 for the MHD default
+            guint       timeout;            // idle seconds before a connection is closed, 0 for never
+            guint       listen_backlog;     // 0 for the MHD default
+        } ServerConfig;
+
+// Result of server_read_entry(): a reference to the decompressed entry, or
+// else an open spill file of size bytes, both owned by the callee; entry
+// NULL and fd -1 when the entry could not be read. content_type is static,
+// or NULL when unknown.
+typedef void (*ServerEntryFunc) (CacheEntry *entry,
+                                 gint fd,
+                                 gsize size,
+                                 const gchar *content_type,
+                                 gpointer user_data);
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_start
+ *
+ * @brief  Start the HTTP server on its own thread, on a pool of
+ *         config->threads threads, or from the default GLib main context
+ *         when config->main_loop is set. In that mode the server cannot
+ *         answer while the main loop is blocked, e.g. on a synchronous
+ *         request to itself.
+ *
+ * @param  [in] config - server settings
+ *
+ * @return TRUE on success, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean server_start ( const ServerConfig *config );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_stop
+ *
+ * @brief  Stop the HTTP server and release open archives
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void server_stop ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_set_loading
+ *
+ * @brief  Tell the server whether the browser is waiting for a page; in
+ *         main loop mode it is then polled ahead of redraws
+ *
+ * @param  [in] loading - TRUE from the start until the end of a page load
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void server_set_loading ( gboolean loading );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_cancel_reads
+ *
+ * @brief  Abandon the entries requested so far that are still waiting for
+ *         or being decompressed, when the browser navigates away; their
+ *         HTTP connections are closed and server_read_entry() callbacks
+ *         receive no entry
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void server_cancel_reads ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_read_entry
+ *
+ * @brief  Read an entry without going through HTTP. The callback runs
+ *         before this returns when the entry is cached or spilled, or else
+ *         in the thread-default main context of the caller once a worker
+ *         has decompressed it.
+ *
+ * @param  [in] url       - <archive path>/__FILES/<entry name>, unescaped
+ * @param  [in] callback  - receives the entry
+ * @param  [in] user_data - passed to callback
+ *
+ * @return TRUE when callback will be called, FALSE when there is no such
+ *         entry
+ *
+ *--------------------------------------------------------------------------*/
+gboolean server_read_entry ( const gchar *url, ServerEntryFunc callback, gpointer user_data );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_get_diagnostics
+ *
+ * @brief  Get the statistics or the access log without going through HTTP
+ *
+ * @param  [in]  url          - SERVER_STATS_URL or SERVER_ACCESSLOG_URL
+ * @param  [out] size         - size of the data
+ * @param  [out] content_type - static MIME type of the data
+ *
+ * @return Newly allocated data, to be freed with g_free(), or NULL for
+ *         other URLs
+ *
+ *--------------------------------------------------------------------------*/
+gpointer server_get_diagnostics ( const gchar *url, gsize *size, const gchar **content_type );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  server_get_uri
+ *
+ * @brief  Build the URI of the default page of an archive, in the
+ *         namespace of its current version when it can be opened
+ *
+ * @param  [in] archive - absolute path of the archive
+ *
+ * @return Newly allocated URI, to be freed with g_free()
+ *
+ *--------------------------------------------------------------------------*/
+gchar *server_get_uri ( const gchar *archive );
+
+
+G_END_DECLS
+
+#endif /* __SERVER_H__ */
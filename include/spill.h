@@ -0,0 +1,180 @@
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+/**
+ * File Name  : spill.h
+ *
+ * Description: Second cache tier for decompressed entries that are too
+ *              large for the in-memory cache
+ *
+ * Large entries are inflated once into files in a (preferably tmpfs)
+ * spill directory and served from there as file descriptors. The total
+ * size of the spill files is capped; least recently used files are
+ * removed first.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define SPILL_DEFAULT_DIR       "/dev/shm/" PACKAGE_NAME
+#define SPILL_DEFAULT_SIZE      (32 * 1024 * 1024)  // in bytes
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct _SpillFile SpillFile;
+
+typedef struct
+        {
+            guint64     hits;           // lookups answered from a spill file
+            guint64     misses;         // lookups without a spill file
+            guint64     stores;         // entries written to the spill directory
+            guint64     evictions;      // files removed to stay within the limit
+            gsize       bytes_used;     // size of all spill files, including pending ones
+            gsize       limit;          // maximum size of all spill files
+            guint       files;          // number of completed spill files
+        } SpillStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  spill_init
+ *
+ * @brief  Prepare a directory of this process in the spill directory,
+ *         removing the ones left by instances that are no longer running
+ *
+ * @param  [in] dir   - spill directory, created when missing; may be
+ *                      shared with other instances
+ * @param  [in] limit - maximum total size of the spill files, 0 disables
+ *
+ * @return TRUE when the spill tier is usable, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean spill_init ( const gchar *dir, gsize limit );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  spill_destroy
+ *
+ * @brief  Remove all spill files; descriptors already handed out stay valid
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void spill_destroy ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  spill_open
+ *
+ * @brief  Open the spill file of an entry and mark it most recently used
+ *
+ * @param  [in]  archive - path of the archive
+ * @param  [in]  version - version of its contents, see archive_get_version()
+ * @param  [in]  name    - name of the entry inside the archive
+ * @param  [out] size    - size of the entry
+ *
+ * @return Read-only file descriptor owned by the caller, or -1 on a miss
+ *
+ *--------------------------------------------------------------------------*/
+gint spill_open ( const gchar *archive, const gchar *version, const gchar *name, gsize *size );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  spill_begin
+ *
+ * @brief  Reserve room for an entry and create its spill file. Write the
+ *         entry to spill_file_get_fd(), then call spill_commit() or
+ *         spill_abort().
+ *
+ * @param  [in] archive - path of the archive
+ * @param  [in] version - version of its contents, see archive_get_version()
+ * @param  [in] name    - name of the entry inside the archive
+ * @param  [in] size    - uncompressed size of the entry
+ *
+ * @return Pending spill file, or NULL when the entry does not fit
+ *
+ *--------------------------------------------------------------------------*/
+SpillFile *spill_begin ( const gchar *archive, const gchar *version, const gchar *name, gsize size );
+
+gint spill_file_get_fd ( SpillFile *file );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  spill_commit
+ *
+ * @brief  Complete a spill file and make it available to spill_open()
+ *
+ * @param  [in] file - pending spill file, freed by this call
+ *
+ * @return Read-only file descriptor owned by the caller, or -1 on error
+ *
+ *--------------------------------------------------------------------------*/
+gint spill_commit ( SpillFile *file );
+
+void spill_abort ( SpillFile *file );
+
+// version NULL removes the files of all versions of the archive
+void spill_invalidate_archive ( const gchar *archive, const gchar *version );
+
+void spill_get_stats ( SpillStats *stats );
+
+
+G_END_DECLS
+
+#endif /* __SPILL_H__ */
@@ -0,0 +1,154 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/**
+ * File Name  : stats.h
+ *
+ * Description: Latency histograms of the phases of serving an entry
+ *
+ * Each phase counts its samples, their total and maximum, and keeps a
+ * histogram with power-of-two buckets: bucket i counts times below 2^i
+ * microseconds, the last bucket all longer ones. Samples are added with
+ * atomic operations only, so the counters can stay on in the field.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define STATS_BUCKETS           24      // the last one starts at 4.2 s
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef enum
+        {
+            STATS_OPEN = 0,             // opening an archive
+            STATS_INDEX,                // reading its central directory
+            STATS_LOOKUP,               // finding an entry in the index
+            STATS_QUEUE,                // waiting for a worker
+            STATS_INFLATE,              // reading an entry on a worker
+            STATS_REQUEST,              // from request to response
+            STATS_PHASES
+        } StatsPhase;
+
+typedef struct
+        {
+            guint       count;          // number of samples
+            guint64     total_us;       // sum of the samples
+            guint       max_us;         // longest sample
+            guint       buckets[STATS_BUCKETS];
+        } PhaseStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  stats_get_time
+ *
+ * @brief  Get the time to pass to stats_add() when a phase is over
+ *
+ * @param  --
+ *
+ * @return Current time in microseconds
+ *
+ *--------------------------------------------------------------------------*/
+gint64 stats_get_time ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  stats_add
+ *
+ * @brief  Add the time since the start of a phase to its histogram; may be
+ *         called from any thread
+ *
+ * @param  [in] phase - phase that is over
+ * @param  [in] start - when it started, from stats_get_time()
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void stats_add ( StatsPhase phase, gint64 start );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  stats_get_phase
+ *
+ * @brief  Get the counters of a phase; they are read one by one, so
+ *         samples added meanwhile may be counted in part
+ *
+ * @param  [in]  phase - phase to report
+ * @param  [out] stats - its counters
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void stats_get_phase ( StatsPhase phase, PhaseStats *stats );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  stats_phase_name
+ *
+ * @brief  Get the name of a phase, as used in the statistics
+ *
+ * @param  [in] phase - phase
+ *
+ * @return Static string
+ *
+ *--------------------------------------------------------------------------*/
+const gchar *stats_phase_name ( StatsPhase phase );
+
+
+G_END_DECLS
+
+#endif /* __STATS_H__ */
@@ -60,6 +60,9 @@ extern "C" {
 #endif
 
 #define Z_BZIP2ED 12
+#define Z_LZMAED 14
+#define Z_ZSTDED 93
+#define Z_AESED 99
 
 #if defined(STRICTUNZIP) || defined(STRICTZIPUNZIP)
 /* like the STRICT of WIN32, we define a pointer that cannot be converted
@@ -79,6 +82,9 @@ typedef voidp unzFile;
 #define UNZ_BADZIPFILE                  (-103)
 #define UNZ_INTERNALERROR               (-104)
 #define UNZ_CRCERROR                    (-105)
+#define UNZ_BADPASSWORD                 (-106)
+#define UNZ_SIZEERROR                   (-107)
+#define UNZ_AUTHERROR                   (-108)
 
 /* tm_unz contain date/time info */
 typedef struct tm_unz_s
@@ -338,8 +344,10 @@ extern int ZEXPORT unzOpenCurrentFilePassword OF((unzFile file,
                                                   const char* password));
 /*
   Open for reading data the current file in the zipfile.
-  password is a crypting password
-  If there is no error, the return value is UNZ_OK.
+  password is a crypting password, used for WinZip AES encrypted files
+    (method 99) and ignored for files that are not encrypted
+  If there is no error, the return value is UNZ_OK; UNZ_BADPASSWORD if the
+    password is missing or wrong.
 */
 
 extern int ZEXPORT unzOpenCurrentFile2 OF((unzFile file,
@@ -374,6 +382,8 @@ extern int ZEXPORT unzCloseCurrentFile OF((unzFile file));
 /*
   Close the file in zip opened with unzOpenCurrentFile
   Return UNZ_CRCERROR if all the file was read but the CRC is not good
+  Return UNZ_AUTHERROR if the authentication code of an AES encrypted file
+    is not good; its data must not be used
 */
 
 extern int ZEXPORT unzReadCurrentFile OF((unzFile file,
@@ -390,6 +400,25 @@ extern int ZEXPORT unzReadCurrentFile OF((unzFile file,
     (UNZ_ERRNO for IO error, or zLib error for uncompress error)
 */
 
+extern int ZEXPORT unzReadCurrentFileFully OF((unzFile file,
+                      voidp buf,
+                      ZPOS64_T len));
+/*
+  Read the whole current file (just opened by unzOpenCurrentFile, nothing
+  read from it yet) into buf. Stored and deflated data are read with one
+  I/O request and decoded with one call straight into buf; other methods
+  go through unzReadCurrentFile.
+  len the size of buf, at least the uncompressed size of the file.
+
+  return UNZ_OK if the whole file was read
+  return UNZ_SIZEERROR if the data does not decode to exactly the size
+    given in the zipfile
+  return UNZ_CRCERROR if the CRC is not good (unless unzSetCrcPolicy
+    turned the check off)
+  return another error code <0 as unzReadCurrentFile does
+  The file must still be closed with unzCloseCurrentFile.
+*/
+
 extern z_off_t ZEXPORT unztell OF((unzFile file));
 
 extern ZPOS64_T ZEXPORT unztell64 OF((unzFile file));
@@ -428,6 +457,31 @@ extern uLong ZEXPORT unzGetOffset (unzFile file);
 extern int ZEXPORT unzSetOffset64 (unzFile file, ZPOS64_T pos);
 extern int ZEXPORT unzSetOffset (unzFile file, uLong pos);
 
+/***************************************************************************/
+
+/* CRC policies */
+#define UNZ_CRC_INLINE  (0)     /* check the CRC of every file read (default) */
+#define UNZ_CRC_SKIP    (1)     /* don't compute CRCs, for verified archives */
+
+typedef struct unz_crc_stats_s
+{
+    ZPOS64_T bytes_checked;     /* bytes added to a CRC */
+    ZPOS64_T bytes_skipped;     /* bytes read without CRC */
+    ZPOS64_T nsec;              /* time spent in crc32, in nanoseconds */
+} unz_crc_stats;
+
+extern int ZEXPORT unzSetCrcPolicy OF((unzFile file, int policy));
+/*
+  Set the CRC policy for the next files opened. With UNZ_CRC_SKIP,
+    unzCloseCurrentFile never returns UNZ_CRCERROR.
+  Return UNZ_PARAMERROR while a file is open.
+*/
+
+extern int ZEXPORT unzGetCrcStats OF((unzFile file, unz_crc_stats* stats));
+/*
+  Get the CRC statistics of all files read since unzOpen
+*/
+
 
 
 #ifdef __cplusplus
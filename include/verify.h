@@ -0,0 +1,157 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+/**
+ * File Name  : verify.h
+ *
+ * Description: CRC verification policy of the served archives
+ *
+ * Checking the CRC of every entry while it is decompressed costs a
+ * noticeable share of CPU time. Depending on the mode, archives can instead
+ * be verified as a whole by a background thread; archives that passed a
+ * full verification are recorded, together with their size and
+ * modification time, and are read without CRC checks from then on.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef enum
+        {
+            VERIFY_INLINE = 0,      // check the CRC of every entry while it is read
+            VERIFY_DEFERRED,        // no inline checks, verify archives in the background
+            VERIFY_TRUSTED,         // inline checks until a full verification is recorded
+        } VerifyMode;
+
+typedef struct
+        {
+            VerifyMode  mode;
+            guint       verified;       // archives known to be intact
+            guint       failed;         // archives that failed verification
+            guint       pending;        // archives waiting for the background verifier
+            guint64     bytes;          // bytes verified in the background
+            guint64     usec;           // time spent verifying in the background
+        } VerifyStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  verify_init
+ *
+ * @brief  Load the recorded verifications and start the background verifier
+ *
+ * @param  [in] mode     - verification mode
+ * @param  [in] password - password of AES encrypted entries, or NULL
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void verify_init ( VerifyMode mode, const gchar *password );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  verify_destroy
+ *
+ * @brief  Stop the background verifier, abandoning archives not yet verified
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void verify_destroy ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  verify_get_policy
+ *
+ * @brief  Decide whether the entries of an archive must be CRC checked,
+ *         queueing the archive for background verification when needed
+ *
+ * @param  [in] archive - path of the archive
+ * @param  [in] size    - size of the archive file, as opened
+ * @param  [in] mtime   - its modification time
+ *
+ * @return UNZ_CRC_INLINE or UNZ_CRC_SKIP, see unzSetCrcPolicy()
+ *
+ *--------------------------------------------------------------------------*/
+gint verify_get_policy ( const gchar *archive, guint64 size, gint64 mtime );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  verify_parse_mode
+ *
+ * @brief  Convert a mode name (inline, deferred, trusted) to its value
+ *
+ * @param  [in]  name - mode name
+ * @param  [out] mode - mode
+ *
+ * @return TRUE when name is a known mode, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean verify_parse_mode ( const gchar *name, VerifyMode *mode );
+
+
+const gchar *verify_mode_name ( VerifyMode mode );
+
+void verify_get_stats ( VerifyStats *stats );
+
+
+G_END_DECLS
+
+#endif /* __VERIFY_H__ */
@@ -0,0 +1,143 @@
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+/**
+ * File Name  : workers.h
+ *
+ * Description: Pool of threads decompressing archive entries concurrently
+ *
+ * Each worker has its own job queues, one per priority; jobs are spread
+ * over the workers, and a worker takes the most urgent job of all queues,
+ * its own first, stealing from the others. A job gains one priority for
+ * every WORKERS_AGING_US it waits, so low priority jobs are not starved.
+ * Every worker owns a context pointer the job function may use for
+ * per-thread state, such as an open archive handle.
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+//----------------------------------------------------------------------------
+// Definitions
+//----------------------------------------------------------------------------
+
+#define WORKERS_MAX             16
+#define WORKERS_PRIORITIES      5               // 0 is the most urgent
+#define WORKERS_AGING_US        (200 * 1000)    // waiting time per priority gained
+
+
+//----------------------------------------------------------------------------
+// Forward Declarations
+//----------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+// Run one job; context points to the per-worker state, initially NULL
+typedef void (*WorkerFunc) (gpointer job, gpointer *context);
+
+typedef struct
+        {
+            guint64     jobs;           // jobs completed
+            guint64     steals;         // jobs taken from another worker's queue
+            guint64     aged;           // jobs run ahead of their priority
+            guint       workers;        // number of worker threads
+            guint       pending;        // jobs waiting in the queues
+        } WorkerStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Public Functions
+//============================================================================
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  workers_init
+ *
+ * @brief  Start the worker threads
+ *
+ * @param  [in] count        - number of workers, 0 for one per online CPU
+ * @param  [in] func         - function running a job
+ * @param  [in] context_free - frees a worker context when its thread ends,
+ *                             or NULL
+ *
+ * @return TRUE when at least one worker is running, FALSE otherwise
+ *
+ *--------------------------------------------------------------------------*/
+gboolean workers_init ( guint count, WorkerFunc func, GDestroyNotify context_free );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  workers_destroy
+ *
+ * @brief  Run the jobs still queued, then stop the worker threads
+ *
+ * @param  --
+ *
+ * @return --
+ *
+ *--------------------------------------------------------------------------*/
+void workers_destroy ( void );
+
+
+/**---------------------------------------------------------------------------
+ *
+ * Name :  workers_submit
+ *
+ * @brief  Queue a job; it runs on one of the worker threads, which must
+ *         hand the result back to the submitter itself. Safe to call from
+ *         any thread.
+ *
+ * @param  [in] job      - job passed to the job function
+ * @param  [in] priority - 0 for the most urgent, up to WORKERS_PRIORITIES - 1
+ *
+ * @return TRUE when queued, FALSE when the pool is not running or is
+ *         stopping; the caller then still owns the job
+ *
+ *--------------------------------------------------------------------------*/
+gboolean workers_submit ( gpointer job, guint priority );
+
+
+void workers_get_stats ( WorkerStats *stats );
+
+
+G_END_DECLS
+
+#endif /* __WORKERS_H__ */
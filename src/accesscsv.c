@@ -0,0 +1,193 @@
+/*
+ * File Name: accesscsv.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+/*
+ * Converter of access log dumps to CSV.
+ *
+ * Reads a dump written on SIGUSR1 or fetched from /__ACCESSLOG, in the
+ * format of accesslog.h, and prints one line per request. Plain C and
+ * independent of the byte order of the device, so it runs on any host.
+ * Not installed; build with 'make accesscsv'.
+ *
+ *   accesscsv access.bin > access.csv
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+// system include files, between < >
+#include <stdio.h>
+#include <string.h>
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+// see accesslog.h
+#define MAGIC           0x4c41425aul
+#define VERSION         1
+#define HEADER_SIZE     12
+#define RECORD_SIZE     128
+#define NAME_OFFSET     32
+#define NAME_LEN        (RECORD_SIZE - NAME_OFFSET)
+
+static const char *sources[] = { "none", "index", "hot", "cache", "spill", "worker" };
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static int          g_swap = 0;     // dump in the other byte order
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static unsigned long       get_u16  (const unsigned char *p);
+static unsigned long       get_u32  (const unsigned char *p);
+static unsigned long long  get_u64  (const unsigned char *p);
+static void                print_record(const unsigned char *rec);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+int main(int argc, char *argv[])
+{
+    unsigned char header[HEADER_SIZE];
+    unsigned char rec[RECORD_SIZE];
+    unsigned long requests;
+    unsigned long count = 0;
+    FILE          *file = NULL;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s DUMP\n", argv[0]);
+        return 2;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(header, sizeof(header), 1, file) != 1)
+    {
+        fprintf(stderr, "%s: too short\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    // the magic tells the byte order of the device
+    if (get_u32(header) != MAGIC)
+    {
+        g_swap = 1;
+    }
+    if (get_u32(header) != MAGIC
+        || get_u16(header + 4) != VERSION
+        || get_u16(header + 6) != RECORD_SIZE)
+    {
+        fprintf(stderr, "%s: not an access log dump of version %d\n", argv[1], VERSION);
+        fclose(file);
+        return 1;
+    }
+    requests = get_u32(header + 8);
+
+    printf("seq,time,duration_us,size,status,source,head,range,in_process,archive,name\n");
+    while (fread(rec, sizeof(rec), 1, file) == 1)
+    {
+        print_record(rec);
+        count++;
+    }
+    fclose(file);
+
+    fprintf(stderr, "%lu of %lu requests\n", count, requests);
+    return 0;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static unsigned long get_u16(const unsigned char *p)
+{
+    return g_swap ? ((unsigned long) p[0] << 8) | p[1]
+                  : ((unsigned long) p[1] << 8) | p[0];
+}
+
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return g_swap ? (get_u16(p) << 16) | get_u16(p + 2)
+                  : (get_u16(p + 2) << 16) | get_u16(p);
+}
+
+
+static unsigned long long get_u64(const unsigned char *p)
+{
+    return g_swap ? ((unsigned long long) get_u32(p) << 32) | get_u32(p + 4)
+                  : ((unsigned long long) get_u32(p + 4) << 32) | get_u32(p);
+}
+
+
+// Offsets as in AccessRecord; the name is quoted as CSV wants it
+static void print_record(const unsigned char *rec)
+{
+    unsigned int source = rec[30];
+    unsigned int flags  = rec[31];
+    unsigned int i;
+
+    printf("%lu,%lu.%06lu,%lu,%llu,%lu,%s,%u,%u,%u,%lu,\"",
+           get_u32(rec),
+           get_u32(rec + 4),
+           get_u32(rec + 8),
+           get_u32(rec + 12),
+           get_u64(rec + 16),
+           get_u16(rec + 28),
+           (source < sizeof(sources) / sizeof(sources[0])) ? sources[source] : "unknown",
+           (flags & 0x01) ? 1 : 0,
+           (flags & 0x02) ? 1 : 0,
+           (flags & 0x04) ? 1 : 0,
+           get_u32(rec + 24));
+
+    for (i = 0; i < NAME_LEN && rec[NAME_OFFSET + i] != '\0'; i++)
+    {
+        if (rec[NAME_OFFSET + i] == '"')
+        {
+            putchar('"');
+        }
+        putchar(rec[NAME_OFFSET + i]);
+    }
+    printf("\"\n");
+}
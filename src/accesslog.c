@@ -0,0 +1,290 @@
+/*
+ * File Name: accesslog.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// local include files, between " "
+#include "log.h"
+#include "accesslog.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+// A record is valid while seq holds its number; a writer clears seq first,
+// so a reader that sees the same number before and after copying the
+// record has a consistent copy
+typedef struct
+{
+    volatile gint   seq;
+    AccessRecord    record;
+} Slot;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define DUMP_BATCH      16              // records per write()
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static Slot             g_ring[ACCESSLOG_RECORDS];
+static volatile gint    g_requests = 0;         // number of the last record
+
+// fixed buffers, as a signal handler cannot allocate
+static gchar            g_dump_path[PATH_MAX];
+static gchar            g_temp_path[PATH_MAX];
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static guint32   get_first_seq  (guint32 last);
+static gboolean  copy_record    (guint32 seq, AccessRecord *record);
+static void      fill_header    (AccessLogHeader *header, guint32 last);
+static gboolean  write_all      (gint fd, const void *buf, gsize len);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gboolean accesslog_init(const gchar *path)
+{
+    gchar    *file = NULL;
+    gchar    *dir  = NULL;
+    gboolean ok;
+
+    file = path ? g_strdup(path)
+                : g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, ACCESSLOG_DUMP_NAME, NULL);
+    dir  = g_path_get_dirname(file);
+
+    ok = (strlen(file) + sizeof(".tmp") <= sizeof(g_temp_path));
+    if (ok)
+    {
+        g_snprintf(g_temp_path, sizeof(g_temp_path), "%s.tmp", file);
+        g_strlcpy(g_dump_path, file, sizeof(g_dump_path));
+        ok = (g_mkdir_with_parents(dir, 0700) == 0);
+    }
+    if (!ok)
+    {
+        WARNPRINTF("cannot dump the access log to [%s]", file);
+        g_dump_path[0] = '\0';
+    }
+
+    g_free(dir);
+    g_free(file);
+    return ok;
+}
+
+
+void accesslog_add(const gchar  *name,
+                   guint        archive_id,
+                   guint        status,
+                   AccessSource source,
+                   guint        flags,
+                   guint64      size,
+                   gint64       start)
+{
+    guint32      seq    = (guint32) g_atomic_int_exchange_and_add(&g_requests, 1) + 1;
+    Slot         *slot  = &g_ring[(seq - 1) & (ACCESSLOG_RECORDS - 1)];
+    AccessRecord *rec   = &slot->record;
+    gint64       now    = stats_get_time();
+    gsize        len    = strlen(name);
+
+    g_atomic_int_set(&slot->seq, 0);
+
+    rec->seq         = seq;
+    rec->time_s      = (guint32) (start / G_USEC_PER_SEC);
+    rec->time_us     = (guint32) (start % G_USEC_PER_SEC);
+    rec->duration_us = (guint32) CLAMP(now - start, 0, G_MAXUINT32);
+    rec->size        = size;
+    rec->archive_id  = archive_id;
+    rec->status      = (guint16) status;
+    rec->source      = (guint8) source;
+    rec->flags       = (guint8) flags;
+
+    // the end of a name tells more than its directories
+    if (len >= ACCESSLOG_NAME_LEN)
+    {
+        name += len - (ACCESSLOG_NAME_LEN - 1);
+    }
+    strncpy(rec->name, name, ACCESSLOG_NAME_LEN - 1);
+    rec->name[ACCESSLOG_NAME_LEN - 1] = '\0';
+
+    g_atomic_int_set(&slot->seq, (gint) seq);
+}
+
+
+gboolean accesslog_dump(void)
+{
+    AccessLogHeader header;
+    AccessRecord    batch[DUMP_BATCH];
+    guint32         last   = (guint32) g_atomic_int_get(&g_requests);
+    guint32         seq;
+    guint           count  = 0;
+    gboolean        ok;
+    gint            saved  = errno;
+    gint            fd;
+
+    if (g_dump_path[0] == '\0')
+    {
+        return FALSE;
+    }
+
+    fd = open(g_temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        errno = saved;
+        return FALSE;
+    }
+
+    fill_header(&header, last);
+    ok = write_all(fd, &header, sizeof(header));
+    for (seq = get_first_seq(last); ok && seq != last + 1; seq++)
+    {
+        if (copy_record(seq, &batch[count]) && ++count == DUMP_BATCH)
+        {
+            ok    = write_all(fd, batch, sizeof(batch));
+            count = 0;
+        }
+    }
+    if (ok && count > 0)
+    {
+        ok = write_all(fd, batch, count * sizeof(AccessRecord));
+    }
+
+    ok = (close(fd) == 0) && ok;
+    ok = ok && (rename(g_temp_path, g_dump_path) == 0);
+    if (!ok)
+    {
+        unlink(g_temp_path);
+    }
+
+    errno = saved;
+    return ok;
+}
+
+
+GByteArray *accesslog_get_dump(void)
+{
+    AccessLogHeader header;
+    AccessRecord    record;
+    GByteArray      *dump = NULL;
+    guint32         last  = (guint32) g_atomic_int_get(&g_requests);
+    guint32         seq;
+
+    dump = g_byte_array_sized_new(sizeof(header) + ACCESSLOG_RECORDS * sizeof(record));
+    fill_header(&header, last);
+    g_byte_array_append(dump, (const guint8 *) &header, sizeof(header));
+    for (seq = get_first_seq(last); seq != last + 1; seq++)
+    {
+        if (copy_record(seq, &record))
+        {
+            g_byte_array_append(dump, (const guint8 *) &record, sizeof(record));
+        }
+    }
+
+    return dump;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+// Number of the oldest record still in the ring
+static guint32 get_first_seq(guint32 last)
+{
+    return (last > ACCESSLOG_RECORDS) ? last - ACCESSLOG_RECORDS + 1 : 1;
+}
+
+
+// Copy a record unless it is being written, or has been overwritten
+static gboolean copy_record(guint32 seq, AccessRecord *record)
+{
+    Slot *slot = &g_ring[(seq - 1) & (ACCESSLOG_RECORDS - 1)];
+
+    if ((guint32) g_atomic_int_get(&slot->seq) != seq)
+    {
+        return FALSE;
+    }
+    memcpy(record, &slot->record, sizeof(*record));
+    return ((guint32) g_atomic_int_get(&slot->seq) == seq);
+}
+
+
+static void fill_header(AccessLogHeader *header, guint32 last)
+{
+    memset(header, 0, sizeof(*header));
+    header->magic       = ACCESSLOG_MAGIC;
+    header->version     = ACCESSLOG_VERSION;
+    header->record_size = sizeof(AccessRecord);
+    header->requests    = last;
+}
+
+
+static gboolean write_all(gint fd, const void *buf, gsize len)
+{
+    const guint8 *data = buf;
+    ssize_t      done;
+
+    while (len > 0)
+    {
+        done = write(fd, data, len);
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            return FALSE;
+        }
+        data += done;
+        len  -= done;
+    }
+    return TRUE;
+}
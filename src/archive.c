@@ -0,0 +1,604 @@
+/*
+ * File Name: archive.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// local include files, between " "
+#include "log.h"
+#include "archive.h"
+#include "cache.h"
+#include "mime.h"
+#include "spill.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+#ifndef UNZ_MAXFILENAMEINZIP
+#define UNZ_MAXFILENAMEINZIP (256)
+#endif
+
+typedef struct
+{
+    unz_file_pos    pos;
+    guint64         size;
+    guint           method;
+    guint32         crc;
+    guint32         dos_date;
+    gboolean        encrypted;
+    const gchar     *content_type;  // static or interned, NULL when unknown
+    SeekIndex       *seek;      // built on the first full read of a large entry
+} IndexEntry;
+
+struct _Archive
+{
+    volatile gint   ref_count;
+    gchar           *path;
+    guint           id;
+    guint64         file_size;  // of the archive when it was indexed
+    gint64          mtime;
+    gchar           *version;   // from file_size and mtime
+    GTree           *index;     // entry name -> IndexEntry, read-only once built
+    GMutex          *mutex;     // protects IndexEntry.seek
+    GList           *lru_link;  // link in g_lru, while registered
+};
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+static const char  *defaults[] = { "index.html", "index.htm" };
+
+#define MAFF_RDF_NAME   "/index.rdf"
+#define MAFF_RDF_MAX    (64 * 1024)     // larger ones are not from a browser
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static GStaticMutex g_registry_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable   *g_archives      = NULL;    // path -> Archive
+static GQueue       *g_lru           = NULL;    // head is most recently used
+static guint        g_max_open       = ARCHIVE_DEFAULT_OPEN;
+static guint        g_next_id        = 0;
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static Archive  *archive_new        (const gchar *path, guint64 size, gint64 mtime);
+static void      unregister         (Archive *archive);
+static gboolean  is_maff            (const gchar *filename);
+static void      read_maff_rdf      (Archive *archive, unzFile zip, const gchar *name);
+static gchar    *get_rdf_resource   (const gchar *text, const gchar *property);
+static gint      file_compare       (gconstpointer a, gconstpointer b, gpointer data);
+static void      index_entry_free   (gpointer data);
+static gboolean  stat_file          (const gchar *path, guint64 *size, gint64 *mtime);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+void archive_init(guint max_open)
+{
+    LOGPRINTF("max_open [%u]", max_open);
+
+    g_static_mutex_lock(&g_registry_mutex);
+    g_archives = g_hash_table_new(g_str_hash, g_str_equal);
+    g_lru      = g_queue_new();
+    g_max_open = MAX(max_open, 1);
+    g_static_mutex_unlock(&g_registry_mutex);
+}
+
+
+void archive_destroy(void)
+{
+    LOGPRINTF("entry");
+
+    g_static_mutex_lock(&g_registry_mutex);
+    if (g_archives)
+    {
+        while (!g_queue_is_empty(g_lru))
+        {
+            unregister(g_queue_peek_head(g_lru));
+        }
+        g_hash_table_destroy(g_archives);
+        g_queue_free(g_lru);
+        g_archives = NULL;
+        g_lru      = NULL;
+    }
+    g_static_mutex_unlock(&g_registry_mutex);
+}
+
+
+Archive *archive_open(const gchar *path)
+{
+    Archive *archive = NULL;
+    Archive *found   = NULL;
+    gchar   *stale   = NULL;
+    guint64 size;
+    gint64  mtime;
+
+    g_return_val_if_fail(path, NULL);
+
+    if (!stat_file(path, &size, &mtime))
+    {
+        return NULL;
+    }
+
+    g_static_mutex_lock(&g_registry_mutex);
+    if (g_archives)
+    {
+        found = g_hash_table_lookup(g_archives, path);
+        if (found && found->file_size == size && found->mtime == mtime)
+        {
+            g_queue_unlink(g_lru, found->lru_link);
+            g_queue_push_head_link(g_lru, found->lru_link);
+            archive = archive_ref(found);
+        }
+    }
+    g_static_mutex_unlock(&g_registry_mutex);
+
+    if (archive)
+    {
+        return archive;
+    }
+
+    // index without the lock: reading a central directory from slow
+    // storage must not hold up requests for other archives
+    archive = archive_new(path, size, mtime);
+    if (archive == NULL)
+    {
+        return NULL;
+    }
+
+    g_static_mutex_lock(&g_registry_mutex);
+    if (g_archives)
+    {
+        found = g_hash_table_lookup(g_archives, path);
+        if (found)
+        {
+            // entries of a file that changed on disk are never served again;
+            // an archive reopened after eviction keeps them
+            if (found->file_size != size || found->mtime != mtime)
+            {
+                stale = g_strdup(found->version);
+            }
+            // stale, or indexed by another thread meanwhile: ours is newest
+            unregister(found);
+        }
+
+        g_queue_push_head(g_lru, archive_ref(archive));
+        archive->lru_link = g_queue_peek_head_link(g_lru);
+        g_hash_table_insert(g_archives, archive->path, archive);
+
+        while (g_queue_get_length(g_lru) > g_max_open)
+        {
+            unregister(g_queue_peek_tail(g_lru));
+        }
+    }
+    g_static_mutex_unlock(&g_registry_mutex);
+
+    if (stale)
+    {
+        cache_invalidate_archive(path, stale);
+        spill_invalidate_archive(path, stale);
+        g_free(stale);
+    }
+
+    return archive;
+}
+
+
+Archive *archive_ref(Archive *archive)
+{
+    g_return_val_if_fail(archive, NULL);
+
+    g_atomic_int_inc(&archive->ref_count);
+    return archive;
+}
+
+
+void archive_unref(Archive *archive)
+{
+    if (archive == NULL)
+    {
+        return;
+    }
+
+    if (g_atomic_int_dec_and_test(&archive->ref_count))
+    {
+        LOGPRINTF("freeing [%s]", archive->path);
+        g_tree_destroy(archive->index);
+        g_mutex_free(archive->mutex);
+        g_free(archive->version);
+        g_free(archive->path);
+        g_free(archive);
+    }
+}
+
+
+const gchar *archive_get_path(const Archive *archive)
+{
+    return archive->path;
+}
+
+
+guint archive_get_id(const Archive *archive)
+{
+    return archive->id;
+}
+
+
+const gchar *archive_get_version(const Archive *archive)
+{
+    return archive->version;
+}
+
+
+void archive_get_file_stat(const Archive *archive, guint64 *size, gint64 *mtime)
+{
+    *size  = archive->file_size;
+    *mtime = archive->mtime;
+}
+
+
+const gchar *archive_resolve(Archive *archive, const gchar *path, ArchiveEntryInfo *info)
+{
+    gpointer   name = NULL;
+    IndexEntry *item = NULL;
+    guint      i;
+
+    g_return_val_if_fail(archive && path && info, NULL);
+
+    if (path[0] == '\0' || path[strlen(path) - 1] != '/')
+    {
+        if (!g_tree_lookup_extended(archive->index, path + 1, &name, (gpointer *) &item))
+        {
+            return NULL;
+        }
+    }
+    else if (is_maff(archive->path))
+    {
+        // fixme display index, or jump to default page if there is only one
+        return NULL;
+    }
+    else
+    {
+        for (i = 0; i < G_N_ELEMENTS(defaults) && item == NULL; i++)
+        {
+            gchar *default_name = g_strconcat(path + 1, defaults[i], NULL);
+            g_tree_lookup_extended(archive->index, default_name, &name, (gpointer *) &item);
+            g_free(default_name);
+        }
+        if (item == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    info->pos          = item->pos;
+    info->size         = item->size;
+    info->method       = item->method;
+    info->content_type = item->content_type;
+    info->crc          = item->crc;
+    info->dos_date     = item->dos_date;
+    info->encrypted    = item->encrypted;
+
+    g_mutex_lock(archive->mutex);
+    info->indexed = (item->seek != NULL);
+    g_mutex_unlock(archive->mutex);
+
+    return name;
+}
+
+
+void archive_set_seek(Archive *archive, const gchar *name, SeekIndex *seek)
+{
+    IndexEntry *item = NULL;
+
+    g_return_if_fail(archive && name);
+
+    item = g_tree_lookup(archive->index, name);
+
+    g_mutex_lock(archive->mutex);
+    if (item && item->seek == NULL)
+    {
+        item->seek = seek;
+        seek       = NULL;
+    }
+    g_mutex_unlock(archive->mutex);
+
+    seekindex_free(seek);
+}
+
+
+gssize archive_read_indexed(Archive      *archive,
+                            const gchar  *name,
+                            guint64      offset,
+                            guchar       *buf,
+                            gsize        len)
+{
+    IndexEntry *item = NULL;
+    SeekIndex  *seek = NULL;
+
+    g_return_val_if_fail(archive && name && buf, -1);
+
+    item = g_tree_lookup(archive->index, name);
+    if (item == NULL)
+    {
+        return -1;
+    }
+
+    // once set, the seek points stay until the archive is freed
+    g_mutex_lock(archive->mutex);
+    seek = item->seek;
+    g_mutex_unlock(archive->mutex);
+
+    if (seek == NULL)
+    {
+        return -1;
+    }
+    return seekindex_read(seek, archive->path, offset, buf, len);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+// Index the entries of an archive; returns a new archive with one reference
+static Archive *archive_new(const gchar *path, guint64 size, gint64 mtime)
+{
+    Archive         *archive = NULL;
+    unzFile         zip      = NULL;
+    GSList          *rdfs    = NULL;
+    GSList          *rdf     = NULL;
+    unz_file_info64 file_info;
+    char            buf[UNZ_MAXFILENAMEINZIP + 1];
+    gint64          start;
+
+    LOGPRINTF("opening [%s]", path);
+
+    start = stats_get_time();
+    zip   = unzOpen64(path);
+    stats_add(STATS_OPEN, start);
+    if (zip == NULL)
+    {
+        WARNPRINTF("cannot open [%s]", path);
+        return NULL;
+    }
+
+    archive            = g_new0(Archive, 1);
+    archive->ref_count = 1;
+    archive->path      = g_strdup(path);
+    archive->file_size = size;
+    archive->mtime     = mtime;
+    archive->version   = g_strdup_printf("%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x", mtime, size);
+    archive->index     = g_tree_new_full(&file_compare, NULL, &g_free, &index_entry_free);
+    archive->mutex     = g_mutex_new();
+
+    g_static_mutex_lock(&g_registry_mutex);
+    archive->id = ++g_next_id;
+    g_static_mutex_unlock(&g_registry_mutex);
+
+    start = stats_get_time();
+    if (unzGoToFirstFile(zip) == UNZ_OK)
+    {
+        do
+        {
+            IndexEntry *item = g_new0(IndexEntry, 1);
+            unzGetCurrentFileInfo64(zip, &file_info, buf, sizeof(buf), NULL, 0, NULL, 0);
+            unzGetFilePos(zip, &item->pos);
+            item->size         = file_info.uncompressed_size;
+            item->method       = file_info.compression_method;
+            item->crc          = file_info.crc;
+            item->dos_date     = file_info.dosDate;
+            item->encrypted    = (file_info.flag & 1) != 0;
+            item->content_type = mime_from_name(buf);
+            g_tree_insert(archive->index, g_strdup(buf), item);
+
+            if (is_maff(path) && g_str_has_suffix(buf, MAFF_RDF_NAME))
+            {
+                rdfs = g_slist_prepend(rdfs, g_strdup(buf));
+            }
+        } while (unzGoToNextFile(zip) == UNZ_OK);
+    }
+
+    // the pages of a maff archive declare their own content type
+    for (rdf = rdfs; rdf; rdf = rdf->next)
+    {
+        read_maff_rdf(archive, zip, rdf->data);
+        g_free(rdf->data);
+    }
+    g_slist_free(rdfs);
+    unzClose(zip);
+    stats_add(STATS_INDEX, start);
+
+    return archive;
+}
+
+
+// Drop an archive from the registry; call with g_registry_mutex held
+static void unregister(Archive *archive)
+{
+    g_hash_table_remove(g_archives, archive->path);
+    g_queue_delete_link(g_lru, archive->lru_link);
+    archive->lru_link = NULL;
+    archive_unref(archive);
+}
+
+
+static gboolean is_maff(const gchar *filename)
+{
+    return g_str_has_suffix(filename, "maff");
+}
+
+
+// Apply the content type and charset an index.rdf of a maff archive
+// declares to the page it names
+static void read_maff_rdf(Archive *archive, unzFile zip, const gchar *name)
+{
+    IndexEntry *item      = g_tree_lookup(archive->index, name);
+    IndexEntry *page      = NULL;
+    gchar      *text      = NULL;
+    gchar      *index     = NULL;
+    gchar      *type      = NULL;
+    gchar      *charset   = NULL;
+    gchar      *page_name = NULL;
+    gboolean   ok         = FALSE;
+
+    if (item == NULL || item->size > MAFF_RDF_MAX)
+    {
+        return;
+    }
+
+    text = g_malloc(item->size + 1);
+    if (unzGoToFilePos(zip, &item->pos) == UNZ_OK
+        && unzOpenCurrentFile(zip) == UNZ_OK)
+    {
+        ok = (unzReadCurrentFileFully(zip, text, item->size) == UNZ_OK);
+        ok = (unzCloseCurrentFile(zip) == UNZ_OK) && ok;
+    }
+    if (!ok)
+    {
+        WARNPRINTF("cannot read [%s]", name);
+        g_free(text);
+        return;
+    }
+    text[item->size] = '\0';
+
+    index   = get_rdf_resource(text, "indexfilename");
+    type    = get_rdf_resource(text, "mimetype");
+    charset = get_rdf_resource(text, "charset");
+
+    if (index && type)
+    {
+        // the rdf sits next to the page, name ends in MAFF_RDF_NAME
+        page_name = g_strdup_printf("%.*s/%s",
+                                    (int) (strlen(name) - strlen(MAFF_RDF_NAME)), name,
+                                    index);
+        page = g_tree_lookup(archive->index, page_name);
+    }
+    if (page)
+    {
+        gchar *value = charset ? g_strdup_printf("%s; charset=%s", type, charset)
+                               : g_strdup(type);
+        LOGPRINTF("[%s] is [%s]", page_name, value);
+        page->content_type = g_intern_string(value);
+        g_free(value);
+    }
+
+    g_free(page_name);
+    g_free(charset);
+    g_free(type);
+    g_free(index);
+    g_free(text);
+}
+
+
+// Get the RDF:resource value of a MAF:<property> element, when it is safe
+// to put in a header
+static gchar *get_rdf_resource(const gchar *text, const gchar *property)
+{
+    const gchar *p     = text;
+    const gchar *end   = NULL;
+    const gchar *value = NULL;
+    gsize       len    = strlen(property);
+
+    while ((p = strstr(p, property)) != NULL)
+    {
+        if (p > text && p[-1] == ':' && !g_ascii_isalnum(p[len]))
+        {
+            end   = strchr(p, '>');
+            value = strstr(p, "resource=\"");
+            if (end && value && value < end)
+            {
+                value += strlen("resource=\"");
+                end = strchr(value, '"');
+                if (end && end > value && end - value < 128)
+                {
+                    const gchar *c;
+
+                    for (c = value; c < end; c++)
+                    {
+                        if (!g_ascii_isprint(*c) || *c == '<' || *c == '>')
+                        {
+                            return NULL;
+                        }
+                    }
+                    return g_strndup(value, end - value);
+                }
+            }
+        }
+        p += len;
+    }
+    return NULL;
+}
+
+
+static gint file_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    return g_ascii_strcasecmp((const char *) a, (const char *) b);
+}
+
+
+static void index_entry_free(gpointer data)
+{
+    IndexEntry *item = data;
+
+    seekindex_free(item->seek);
+    g_free(item);
+}
+
+
+static gboolean stat_file(const gchar *path, guint64 *size, gint64 *mtime)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        return FALSE;
+    }
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
+    return TRUE;
+}
@@ -0,0 +1,337 @@
+/*
+ * File Name: cache.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+
+// local include files, between " "
+#include "log.h"
+#include "cache.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+struct _CacheEntry
+{
+    volatile gint refcount;
+    gchar         *key;         // archive + '\n' + version + '\n' + entry name
+    gchar         *archive;
+    gchar         *version;
+    gsize         size;
+    GList         *lru_link;    // link in g_lru, NULL when not cached
+    guchar        data[];       // decompressed entry, handed out as is
+};
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static GStaticMutex g_cache_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable   *g_entries    = NULL;   // key -> CacheEntry
+static GQueue       *g_lru        = NULL;   // head is most recently used
+static CacheStats   g_stats;
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static gchar *make_key          (const gchar *archive, const gchar *version, const gchar *name);
+static void   remove_entry      (CacheEntry *entry);
+static void   evict_until       (gsize needed);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+void cache_init(gsize budget)
+{
+    LOGPRINTF("budget [%lu]", (gulong) budget);
+
+    g_static_mutex_lock(&g_cache_mutex);
+    if (g_entries == NULL)
+    {
+        g_entries = g_hash_table_new(g_str_hash, g_str_equal);
+        g_lru     = g_queue_new();
+    }
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.budget = budget;
+    g_static_mutex_unlock(&g_cache_mutex);
+}
+
+
+void cache_destroy(void)
+{
+    LOGPRINTF("entry");
+
+    g_static_mutex_lock(&g_cache_mutex);
+    if (g_entries)
+    {
+        while (!g_queue_is_empty(g_lru))
+        {
+            remove_entry(g_queue_peek_head(g_lru));
+        }
+        g_hash_table_destroy(g_entries);
+        g_queue_free(g_lru);
+        g_entries = NULL;
+        g_lru     = NULL;
+    }
+    g_static_mutex_unlock(&g_cache_mutex);
+}
+
+
+CacheEntry *cache_lookup(const gchar *archive, const gchar *version, const gchar *name)
+{
+    CacheEntry *entry = NULL;
+    gchar      *key   = NULL;
+
+    g_return_val_if_fail(archive && version && name, NULL);
+
+    key = make_key(archive, version, name);
+
+    g_static_mutex_lock(&g_cache_mutex);
+    if (g_entries)
+    {
+        entry = g_hash_table_lookup(g_entries, key);
+        if (entry)
+        {
+            // move to front of LRU list
+            g_queue_unlink(g_lru, entry->lru_link);
+            g_queue_push_head_link(g_lru, entry->lru_link);
+            cache_entry_ref(entry);
+            g_stats.hits++;
+        }
+        else
+        {
+            g_stats.misses++;
+        }
+    }
+    g_static_mutex_unlock(&g_cache_mutex);
+
+    g_free(key);
+    return entry;
+}
+
+
+CacheEntry *cache_entry_new(const gchar *archive,
+                            const gchar *version,
+                            const gchar *name,
+                            gsize size)
+{
+    CacheEntry *entry = NULL;
+
+    g_return_val_if_fail(archive && version && name, NULL);
+
+    entry = g_try_malloc(sizeof(CacheEntry) + size);
+    if (entry == NULL)
+    {
+        ERRORPRINTF("cannot allocate [%lu] bytes for [%s]", (gulong) size, name);
+        return NULL;
+    }
+
+    entry->refcount = 1;
+    entry->key      = make_key(archive, version, name);
+    entry->archive  = g_strdup(archive);
+    entry->version  = g_strdup(version);
+    entry->size     = size;
+    entry->lru_link = NULL;
+
+    return entry;
+}
+
+
+void cache_insert(CacheEntry *entry)
+{
+    CacheEntry *old = NULL;
+
+    g_return_if_fail(entry && entry->lru_link == NULL);
+
+    g_static_mutex_lock(&g_cache_mutex);
+    if (g_entries == NULL)
+    {
+        // cache not initialised
+    }
+    else if (entry->size > g_stats.budget)
+    {
+        LOGPRINTF("entry too large [%lu]", (gulong) entry->size);
+        g_stats.rejected++;
+    }
+    else
+    {
+        old = g_hash_table_lookup(g_entries, entry->key);
+        if (old)
+        {
+            remove_entry(old);
+        }
+        evict_until(g_stats.budget - entry->size);
+
+        cache_entry_ref(entry);
+        g_queue_push_head(g_lru, entry);
+        entry->lru_link = g_queue_peek_head_link(g_lru);
+        g_hash_table_insert(g_entries, entry->key, entry);
+
+        g_stats.bytes_used += entry->size;
+        g_stats.entries++;
+        g_stats.insertions++;
+    }
+    g_static_mutex_unlock(&g_cache_mutex);
+}
+
+
+void cache_invalidate_archive(const gchar *archive, const gchar *version)
+{
+    GList *link = NULL;
+    GList *next = NULL;
+
+    g_return_if_fail(archive);
+
+    g_static_mutex_lock(&g_cache_mutex);
+    if (g_lru)
+    {
+        for (link = g_queue_peek_head_link(g_lru); link; link = next)
+        {
+            CacheEntry *entry = link->data;
+            next = link->next;
+            if (strcmp(entry->archive, archive) == 0
+                && (version == NULL || strcmp(entry->version, version) == 0))
+            {
+                remove_entry(entry);
+            }
+        }
+    }
+    g_static_mutex_unlock(&g_cache_mutex);
+}
+
+
+gboolean cache_can_hold(gsize size)
+{
+    gboolean fits;
+
+    g_static_mutex_lock(&g_cache_mutex);
+    fits = (g_entries != NULL && size <= g_stats.budget);
+    g_static_mutex_unlock(&g_cache_mutex);
+
+    return fits;
+}
+
+
+CacheEntry *cache_entry_ref(CacheEntry *entry)
+{
+    g_return_val_if_fail(entry, NULL);
+
+    g_atomic_int_inc(&entry->refcount);
+    return entry;
+}
+
+
+void cache_entry_unref(CacheEntry *entry)
+{
+    g_return_if_fail(entry);
+
+    if (g_atomic_int_dec_and_test(&entry->refcount))
+    {
+        g_free(entry->key);
+        g_free(entry->archive);
+        g_free(entry->version);
+        g_free(entry);
+    }
+}
+
+
+guchar *cache_entry_get_data(CacheEntry *entry)
+{
+    return entry->data;
+}
+
+
+gsize cache_entry_get_size(const CacheEntry *entry)
+{
+    return entry->size;
+}
+
+
+CacheEntry *cache_entry_from_data(gpointer data)
+{
+    return (CacheEntry *) ((guchar *) data - G_STRUCT_OFFSET(CacheEntry, data));
+}
+
+
+void cache_get_stats(CacheStats *stats)
+{
+    g_return_if_fail(stats);
+
+    g_static_mutex_lock(&g_cache_mutex);
+    *stats = g_stats;
+    g_static_mutex_unlock(&g_cache_mutex);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static gchar *make_key(const gchar *archive, const gchar *version, const gchar *name)
+{
+    return g_strconcat(archive, "\n", version, "\n", name, NULL);
+}
+
+
+// call with g_cache_mutex held
+static void remove_entry(CacheEntry *entry)
+{
+    g_hash_table_remove(g_entries, entry->key);
+    g_queue_delete_link(g_lru, entry->lru_link);
+    entry->lru_link = NULL;
+
+    g_stats.bytes_used -= entry->size;
+    g_stats.entries--;
+
+    cache_entry_unref(entry);
+}
+
+
+// call with g_cache_mutex held
+static void evict_until(gsize needed)
+{
+    while (g_stats.bytes_used > needed && !g_queue_is_empty(g_lru))
+    {
+        CacheEntry *entry = g_queue_peek_tail_link(g_lru)->data;
+        LOGPRINTF("evicting [%s]", entry->key);
+        remove_entry(entry);
+        g_stats.evictions++;
+    }
+}
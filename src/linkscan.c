@@ -0,0 +1,211 @@
+/*
+ * File Name: linkscan.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+
+// local include files, between " "
+#include "linkscan.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef enum
+{
+    STATE_TEXT = 0,                 // looking for a keyword
+    STATE_BEFORE_VALUE,             // after a keyword, up to the value
+    STATE_VALUE                     // in the value
+} ScanState;
+
+struct _LinkScanner
+{
+    LinkScanFunc    func;
+    gpointer        user_data;
+    gboolean        stopped;
+    ScanState       state;
+    gboolean        import;         // after @import, where only a quote may follow
+    gchar           quote;          // of the value, or 0 when unquoted
+    gchar           window[8];      // last characters, in lower case
+    gchar           link[LINKSCAN_MAX_LINK + 1];
+    gsize           len;
+    gboolean        overflow;       // value too long, skip it
+};
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define WINDOW_SIZE     (sizeof(((LinkScanner *) NULL)->window))
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static void     scan_char       (LinkScanner *scanner, gchar ch);
+static gboolean window_ends_with(const LinkScanner *scanner, const gchar *keyword);
+static void     end_value       (LinkScanner *scanner);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+LinkScanner *linkscan_new(LinkScanFunc func, gpointer user_data)
+{
+    LinkScanner *scanner = NULL;
+
+    g_return_val_if_fail(func, NULL);
+
+    scanner            = g_new0(LinkScanner, 1);
+    scanner->func      = func;
+    scanner->user_data = user_data;
+    return scanner;
+}
+
+
+gboolean linkscan_feed(LinkScanner *scanner, const guchar *data, gsize len)
+{
+    gsize i;
+
+    g_return_val_if_fail(scanner && (data || len == 0), FALSE);
+
+    for (i = 0; i < len && !scanner->stopped; i++)
+    {
+        scan_char(scanner, (gchar) data[i]);
+    }
+    return !scanner->stopped;
+}
+
+
+void linkscan_free(LinkScanner *scanner)
+{
+    g_free(scanner);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static void scan_char(LinkScanner *scanner, gchar ch)
+{
+    memmove(scanner->window, scanner->window + 1, WINDOW_SIZE - 1);
+    scanner->window[WINDOW_SIZE - 1] = g_ascii_tolower(ch);
+
+    switch (scanner->state)
+    {
+    case STATE_VALUE:
+        if (scanner->quote ? (ch == scanner->quote || ch == '\n')
+                           : (g_ascii_isspace(ch) || ch == '>' || ch == ')' || ch == ';'))
+        {
+            end_value(scanner);
+        }
+        else if (scanner->len < LINKSCAN_MAX_LINK)
+        {
+            scanner->link[scanner->len++] = ch;
+        }
+        else
+        {
+            scanner->overflow = TRUE;
+        }
+        return;
+
+    case STATE_BEFORE_VALUE:
+        if (g_ascii_isspace(ch))
+        {
+            return;
+        }
+        scanner->len      = 0;
+        scanner->overflow = FALSE;
+        if (ch == '"' || ch == '\'')
+        {
+            scanner->quote = ch;
+            scanner->state = STATE_VALUE;
+            return;
+        }
+        if (!scanner->import && ch != '>')
+        {
+            scanner->quote   = 0;
+            scanner->link[0] = ch;
+            scanner->len     = 1;
+            scanner->state   = STATE_VALUE;
+            return;
+        }
+        // @import url(...) is taken as url( below
+        scanner->state = STATE_TEXT;
+        break;
+
+    case STATE_TEXT:
+        break;
+    }
+
+    if (window_ends_with(scanner, "src=") || window_ends_with(scanner, "href=")
+        || window_ends_with(scanner, "url("))
+    {
+        scanner->state  = STATE_BEFORE_VALUE;
+        scanner->import = FALSE;
+    }
+    else if (window_ends_with(scanner, "@import"))
+    {
+        scanner->state  = STATE_BEFORE_VALUE;
+        scanner->import = TRUE;
+    }
+}
+
+
+static gboolean window_ends_with(const LinkScanner *scanner, const gchar *keyword)
+{
+    gsize len = strlen(keyword);
+
+    return (memcmp(scanner->window + WINDOW_SIZE - len, keyword, len) == 0);
+}
+
+
+static void end_value(LinkScanner *scanner)
+{
+    scanner->state = STATE_TEXT;
+    if (scanner->len == 0 || scanner->overflow)
+    {
+        return;
+    }
+
+    scanner->link[scanner->len] = '\0';
+    if (!scanner->func(scanner->link, scanner->user_data))
+    {
+        scanner->stopped = TRUE;
+    }
+}
@@ -40,26 +40,25 @@
 #include <unistd.h>
 #include <webkit/webkit.h>
 #include <libsoup/soup.h>
+#include <gconf/gconf-client.h>
 #include <stdlib.h>
 
 // ereader include files, between < >
 #include <liberutils/display_utils.h>
 
-#include <glib/gprintf.h>
-#include <microhttpd.h>
-#include <glib/gtree.h>
-
-// for profiling
-#include <sys/time.h>
-
 // local include files, between " "
 #include "log.h"
+#include "accesslog.h"
+#include "cache.h"
 #include "i18n.h"
 #include "ipc.h"
 #include "main.h"
 #include "menu.h"
+#include "scheme.h"
+#include "server.h"
+#include "spill.h"
+#include "verify.h"
 #include "view.h"
-#include "unzip.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -75,6 +74,9 @@
 
 #define COOKIES_FILE "/home/root/cookies.txt"
 
+// defaults of the server settings, overridden by the command line
+#define GCONF_SERVER_DIR    "/apps/er/erbrowser/server"
+
 static const gfloat zoom_step        = 0.20f;
 static const gchar  *rc_filename     = DATADIR "/" PACKAGE_NAME ".rc";
 static const gchar  *css_uri         = "file://" DATADIR "/" PACKAGE_NAME ".css";
@@ -182,6 +184,37 @@ static void on_fpe(int signo)
     exit(EXIT_FAILURE);
 }
 
+// no logging here: only async-signal-safe calls
+static void on_dump_access_log(int signo)
+{
+    UNUSED(signo);
+    accesslog_dump();
+}
+
+
+// Read an integer key of the server settings; value when it is not set
+static gint get_server_setting(GConfClient *client, const gchar *name, gint value)
+{
+    gchar      *key    = g_strconcat(GCONF_SERVER_DIR "/", name, NULL);
+    GConfValue *gvalue = gconf_client_get(client, key, NULL);
+
+    if (gvalue)
+    {
+        if (gvalue->type == GCONF_VALUE_INT)
+        {
+            value = gconf_value_get_int(gvalue);
+        }
+        else if (gvalue->type == GCONF_VALUE_BOOL)
+        {
+            value = gconf_value_get_bool(gvalue);
+        }
+        gconf_value_free(gvalue);
+    }
+    g_free(key);
+
+    return value;
+}
+
 
 static gboolean show_web_view_cb(BrowserWindow *window, WebKitWebView *web_view)
 {
@@ -246,174 +279,6 @@ static gboolean show_web_view_cb(BrowserWindow *window, WebKitWebView *web_view)
     return TRUE;
 }
 
-// zipbrowser:
-const char* fileNotFound = "<html><body>File not found</body></html>";
-const char* defaults[] = { "index.html", "index.htm" };
-const int nDefaults = 2;
-
-char* currentZName = NULL;
-unzFile currentZ;
-
-bool is_maff(const char* filename) {
-	return strlen(filename) >= 4 && strcmp(filename+strlen(filename)-4,"maff")==0;
-}
-
-GTree* fileCache = NULL;
-
-gint fileCompare(gconstpointer a, gconstpointer b, gpointer data) {
-	return g_ascii_strcasecmp((const char*)a,(const char*)b);
-}
-
-#ifndef UNZ_MAXFILENAMEINZIP
-#define UNZ_MAXFILENAMEINZIP (256)
-#endif
-
-void refreshFileCache() {
-	if(fileCache != NULL) g_tree_destroy(fileCache);
-	//WARNPRINTF("refreshing cache");
-	files = g_tree_new_full(&fileCompare, NULL, &g_free, &g_free);
-	if(unzGoToFirstFile(currentZ) != UNZ_OK) return;
-	unz_file_info* fileInfo = g_malloc(sizeof(unz_file_info));
-	char buf[UNZ_MAXFILENAMEINZIP+1];
-	do {
-		unz_file_pos* filePos  = g_malloc(sizeof(unz_file_pos));
-		unzGetCurrentFileInfo (currentZ, fileInfo, buf, UNZ_MAXFILENAMEINZIP+1, NULL, 0, NULL, 0);
-		char* fileName = g_strdup(buf);
-		unzGetFilePos(currentZ, filePos);
-		g_tree_insert(fileCache, fileName, filePos);
-	} while(unzGoToNextFile(currentZ) == UNZ_OK);
-	g_free(fileInfo);
-}
-
-bool locateFileInCache(const char* fileName) {
-	struct unz_file_pos *pos;
-	pos = g_tree_lookup(fileCache, fileName);
-	if(pos != NULL) {
-		unzGoToFilePos(currentZ, (unz_file_pos*)pos);
-		return true;
-	} else {
-		unzGoToFirstFile (currentZ);
-		return false;
-	}
-}
-
-static int serve_http(void * cls, struct MHD_Connection * connection, const char * url,
-					const char * method, const char * version, const char * upload_data,
-					size_t * upload_data_size, void ** ptr) {
-	//WARNPRINTF("request: %s\n", url);
-	// struct timeval start,end;
-	static int dummy;
-	const char *file;
-	char* zipFile, *nFile;
-	struct MHD_Response* response;
-	int ret, i;
-	if (0 != strcmp(method, "GET")) return MHD_NO;
-	if (&dummy != *ptr) {
-		*ptr = &dummy;
-		return MHD_YES;
-	}
-	*ptr = NULL;
-	// gettimeofday(&start,NULL);	
-	file = strstr(url, "/__FILES/");
-	if(file == NULL || strlen(file) < 9) goto notFound1;	
-	
-	//WARNPRINTF("request serving: %s\n", url);
-	zipFile = g_strndup(url, file-url);
-	// WARNPRINTF("current: %s   requested: %s\n", currentZName, zipFile);
-	if(currentZName != NULL && strcmp(currentZName,zipFile)==0) {
-		// use current file
-		// WARNPRINTF("using current zip file");
-	} else {
-		// WARNPRINTF("opening zip file");
-		if(currentZName != NULL) unzClose(currentZ);
-		g_free(currentZName);
-		currentZName = g_strdup(zipFile);
-		currentZ = unzOpen(zipFile);
-		refreshFileCache();
-	}
-	if(currentZ == NULL) goto notFound2;
-
-	// DEBUG
-	//gettimeofday(&end,NULL);
-	//WARNPRINTF("opening zip time: %ld", 1000000*(end.tv_sec-start.tv_sec) + end.tv_usec - start.tv_usec);
-	// END DEBUG
-
-	file += 8;	// skip "/__FILES/" part
-	if(strlen(file) >= 2 && file[0] == '/' && file[1] == '/') file++; // skip double leading slash
-	if(file[strlen(file)-1]=='/') {
-		if(is_maff(zipFile)) {
-			// fixme display index, or jump to default page if there is only one
-			goto notFound3;
-		} else {
-			bool ok = false;
-			for(i=0;i < nDefaults && !ok; i++) {
-				nFile = g_strdup_printf("%s%s", file, defaults[i]);
-				// if(unzLocateFile(currentZ, nFile+1, 2) == UNZ_OK) ok = true;
-				if(locateFileInCache(nFile+1)) ok = true;
-				g_free(nFile);
-			}
-			if(!ok) goto notFound3;
-		}
-	} else {
-		// if(unzLocateFile (currentZ, file+1, 2) != UNZ_OK) goto notFound3;
-		if(!locateFileInCache(file+1)) goto notFound3;
-		
-	}
-	//WARNPRINTF("LOCATED FILE");
-	// DEBUG
-	// gettimeofday(&end,NULL);
-	// WARNPRINTF("locating time: %ld", 1000000*(end.tv_sec-start.tv_sec) + end.tv_usec - start.tv_usec);
-	// END DEBUG
-	if(unzOpenCurrentFile (currentZ) != UNZ_OK) goto notFound3;
-	struct unz_file_info_s fileInfo;
-	unzGetCurrentFileInfo(currentZ, &fileInfo, NULL, 0, NULL, 0, NULL, 0);
-	unsigned char* data = malloc(fileInfo.uncompressed_size); // g_malloc(fileInfo.uncompressed_size);
-	//WARNPRINTF("ALLOCATED DATA: %ld", fileInfo.uncompressed_size);
-	if(data == NULL) goto notFound4;
-	if(unzReadCurrentFile (currentZ, data, fileInfo.uncompressed_size) < 0) goto notFound5;
-	// response = MHD_create_response_from_data(fileInfo.uncompressed_size, (void*)data, MHD_NO, MHD_YES);
-	response = MHD_create_response_from_data(fileInfo.uncompressed_size, (void*)data, MHD_YES, MHD_NO);
-	if(response == NULL) goto notFound5;
-	ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-	//WARNPRINTF("RESPONSE QUEUED");
-	MHD_destroy_response(response);
-	// g_free(data);
-	unzCloseCurrentFile(currentZ);
-	g_free(zipFile);
-	// WARNPRINTF("DATA FREED");	
-	// DEBUG
-	// gettimeofday(&end,NULL);
-	// WARNPRINTF("request time: %ld", 1000000*(end.tv_sec-start.tv_sec) + end.tv_usec - start.tv_usec);
-	// END DEBUG
-
-	return ret;
-
-	// error handling
-	notFound5:
-	//WARNPRINTF("notFound5");
-	free(data);
-    notFound4:
-	//WARNPRINTF("notFound4");
-	unzCloseCurrentFile(currentZ);
-    notFound3:
-	//WARNPRINTF("notFound3");
-	// unzClose(z);
-	// if(currentZName != NULL) {
-	//	g_free(currentZName);
-	//	currentZName = NULL;
-	// }
-	notFound2:
-	//WARNPRINTF("notFound2");
-	g_free(zipFile);
-	notFound1:
-	//WARNPRINTF("notFound1");
-	response = MHD_create_response_from_data(strlen(fileNotFound), (void*) fileNotFound, MHD_NO, MHD_NO);
-	ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-	MHD_destroy_response(response);
-	//WARNPRINTF("REQUEST DONE");
-	return ret;
-}
-
 // ------------------------------------------------------------------------------------------------
 
 int main(int argc, char *argv[])
@@ -427,6 +292,22 @@ int main(int argc, char *argv[])
     gboolean            embedded_mode       = FALSE;
     gchar               *application        = NULL;
     gchar               **args              = NULL;
+    gint                cache_size          = CACHE_DEFAULT_SIZE / 1024;
+    gchar               *spill_dir          = NULL;
+    gint                spill_size          = SPILL_DEFAULT_SIZE / 1024;
+    gchar               *crc_mode           = NULL;
+    gchar               *password           = NULL;
+    gint                port                = SERVER_DEFAULT_PORT;
+    gint                threads             = SERVER_DEFAULT_THREADS;
+    gboolean            server_main_loop    = FALSE;
+    gint                connections         = SERVER_DEFAULT_CONNECTIONS;
+    gint                connection_memory   = SERVER_DEFAULT_CONN_MEMORY / 1024;
+    gint                timeout             = SERVER_DEFAULT_TIMEOUT;
+    gint                listen_backlog      = SERVER_DEFAULT_BACKLOG;
+    GConfClient         *gconf              = NULL;
+    gboolean            use_http            = FALSE;
+    gboolean            use_scheme          = FALSE;
+    ServerConfig        server_config;
     struct sigaction    action;
 
     GOptionEntry entries[] =  
@@ -438,6 +319,19 @@ int main(int argc, char *argv[])
         { "emall",         'm', 0, G_OPTION_ARG_NONE, &g_run_emall,    "Open browser with eMall", NULL },
         { "embedded",      'e', 0, G_OPTION_ARG_STRING, &application,    "Start browser from other application", 
                                                         "Application name which launch the browser" },
+        { "cache-size",    'c', 0, G_OPTION_ARG_INT,  &cache_size,       "Decompressed entry cache size in KiB, 0 to disable", NULL },
+        { "spill-dir",     0,   0, G_OPTION_ARG_STRING, &spill_dir,      "Directory (preferably tmpfs) for large decompressed entries", "DIR" },
+        { "spill-size",    0,   0, G_OPTION_ARG_INT,  &spill_size,       "Spill directory size limit in KiB, 0 to disable", NULL },
+        { "crc",           0,   0, G_OPTION_ARG_STRING, &crc_mode,       "Entry CRC checks: inline, deferred or trusted", "MODE" },
+        { "password",      0,   0, G_OPTION_ARG_STRING, &password,       "Password of AES encrypted archive entries", NULL },
+        { "port",          0,   0, G_OPTION_ARG_INT,  &port,             "HTTP server port on the loopback interface", NULL },
+        { "threads",       0,   0, G_OPTION_ARG_INT,  &threads,          "Number of HTTP server threads", NULL },
+        { "server-main-loop", 0, 0, G_OPTION_ARG_NONE, &server_main_loop, "Run the HTTP server from the main loop instead of its own threads", NULL },
+        { "connections",   0,   0, G_OPTION_ARG_INT,  &connections,      "HTTP connection limit, 0 for the library default", NULL },
+        { "connection-memory", 0, 0, G_OPTION_ARG_INT, &connection_memory, "Memory per HTTP connection in KiB, 0 for the library default", NULL },
+        { "timeout",       0,   0, G_OPTION_ARG_INT,  &timeout,          "Seconds before an idle HTTP connection is closed, 0 for never", NULL },
+        { "listen-backlog", 0,  0, G_OPTION_ARG_INT,  &listen_backlog,   "HTTP listen backlog, 0 for the library default", NULL },
+        { "http",          0,   0, G_OPTION_ARG_NONE, &use_http,         "Load archives over loopback HTTP instead of zip: URIs", NULL },
         { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &args, NULL, "[URI]"},
         { NULL, 0, 0, 0, NULL, NULL, NULL }
     };
@@ -460,12 +354,32 @@ int main(int argc, char *argv[])
     action.sa_handler = on_fpe;
     sigaction(SIGFPE, &action, NULL);
 
+    // Dump the access log on SIGUSR1
+    memset(&action, 0x00, sizeof(action));
+    action.sa_handler = on_dump_access_log;
+    action.sa_flags   = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
     // init domain for translations
     textdomain(GETTEXT_PACKAGE);
     
     // init glib and threading
     g_type_init();
     g_thread_init(NULL);
+
+    // server settings, before the command line overrides them
+    gconf = gconf_client_get_default();
+    if (gconf)
+    {
+        port              = get_server_setting(gconf, "port", port);
+        threads           = get_server_setting(gconf, "threads", threads);
+        server_main_loop  = get_server_setting(gconf, "main_loop", server_main_loop);
+        connections       = get_server_setting(gconf, "connection_limit", connections);
+        connection_memory = get_server_setting(gconf, "connection_memory", connection_memory);
+        timeout           = get_server_setting(gconf, "timeout", timeout);
+        listen_backlog    = get_server_setting(gconf, "listen_backlog", listen_backlog);
+        g_object_unref(gconf);
+    }
     
     // parse commandline arguments
     context = g_option_context_new("- list URIs to open in browser");
@@ -501,6 +415,9 @@ int main(int argc, char *argv[])
     SoupCookieJar *jar = soup_cookie_jar_text_new(COOKIES_FILE, FALSE);
     soup_session_add_feature(session, SOUP_SESSION_FEATURE(jar));
     g_object_unref(jar);
+
+    // load archive entries in-process, keeping HTTP as a fallback
+    use_scheme = !use_http && scheme_init(session);
    
     // create web view
     BrowserWindow *window = view_create();
@@ -574,10 +491,34 @@ int main(int argc, char *argv[])
 
     ipc_sys_startup_complete();
 
-	// run the http server
-	struct MHD_Daemon *d = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY,7766,NULL,NULL,&serve_http,NULL,MHD_OPTION_END);
-  	if (d == NULL) return 1;	
-	
+    // run the http server
+    if (port <= 0 || port > G_MAXUINT16)
+    {
+        WARNPRINTF("invalid port [%d], using %d", port, SERVER_DEFAULT_PORT);
+        port = SERVER_DEFAULT_PORT;
+    }
+    server_config.port       = (guint16) port;
+    server_config.cache_size = (gsize) MAX(cache_size, 0) * 1024;
+    server_config.spill_dir  = spill_dir ? spill_dir : SPILL_DEFAULT_DIR;
+    server_config.spill_size = (gsize) MAX(spill_size, 0) * 1024;
+    server_config.crc_mode   = VERIFY_INLINE;
+    if (crc_mode && !verify_parse_mode(crc_mode, &server_config.crc_mode))
+    {
+        WARNPRINTF("unknown CRC mode [%s], using inline", crc_mode);
+    }
+    server_config.password   = password;
+    server_config.threads    = (guint) MAX(threads, 1);
+    server_config.main_loop  = server_main_loop;
+    server_config.http       = !use_scheme;
+    server_config.connection_limit  = (guint) MAX(connections, 0);
+    server_config.connection_memory = (gsize) MAX(connection_memory, 0) * 1024;
+    server_config.timeout           = (guint) MAX(timeout, 0);
+    server_config.listen_backlog    = (guint) MAX(listen_backlog, 0);
+    if (!server_start(&server_config))
+    {
+        return 1;
+    }
+
     // open url
     if (g_run_emall)
     {
@@ -588,8 +529,8 @@ int main(int argc, char *argv[])
         gchar *uri = NULL;
         LOGPRINTF("opening URL: %s", uri);
 //        uri = g_strdup((gchar *) (args ? args[0] : "http://www.google.com/"));
-		char* a = args ? args[0] : "";
-		uri = g_strdup_printf("http://127.0.0.1:7766%s/__FILES/",a);
+        uri = use_scheme ? scheme_get_uri(args ? args[0] : NULL)
+                         : server_get_uri(args ? args[0] : NULL);
         view_open_uri(uri);
         g_free(uri);
     }
@@ -601,9 +542,9 @@ int main(int argc, char *argv[])
     gdk_threads_leave();    
     LOGPRINTF("after gtk_main");
 
-	// stop the http server
-	MHD_stop_daemon(d);	
-	
+    // stop the http server
+    server_stop();
+
     // clean up
     ipc_sys_disconnect();
     g_object_unref(web_settings);
@@ -0,0 +1,121 @@
+/*
+ * File Name: mime.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+
+// local include files, between " "
+#include "mime.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct
+{
+    const gchar *ext;           // lower case, without the dot
+    const gchar *type;
+} MimeType;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+// MIME_SEED, MIME_SLOT_BITS, MIME_MAX_EXT and mime_table
+#include "mime-table.h"
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static guint mime_hash (const gchar *ext, gsize len);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+const gchar *mime_from_name(const gchar *name)
+{
+    const gchar    *ext  = NULL;
+    const MimeType *slot = NULL;
+    gsize          len;
+
+    g_return_val_if_fail(name, NULL);
+
+    // scan back from the end, over the extension only
+    len = strlen(name);
+    for (ext = name + len; ext > name && ext[-1] != '.'; ext--)
+    {
+        if (ext[-1] == '/' || name + len - ext > MIME_MAX_EXT)
+        {
+            return NULL;
+        }
+    }
+    if (ext == name)
+    {
+        return NULL;
+    }
+
+    len  = name + len - ext;
+    slot = &mime_table[mime_hash(ext, len)];
+    if (slot->ext
+        && g_ascii_strncasecmp(slot->ext, ext, len) == 0
+        && slot->ext[len] == '\0')
+    {
+        return slot->type;
+    }
+    return NULL;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+// FNV-1a on the lower case extension, top bits; must match mimegen.c
+static guint mime_hash(const gchar *ext, gsize len)
+{
+    guint32 h = MIME_SEED;
+    gsize   i;
+
+    for (i = 0; i < len; i++)
+    {
+        h = (h ^ (guchar) g_ascii_tolower(ext[i])) * 16777619u;
+    }
+    return h >> (32 - MIME_SLOT_BITS);
+}
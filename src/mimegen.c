@@ -0,0 +1,219 @@
+/*
+ * File Name: mimegen.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+/*
+ * Generator of the Content-Type table of mime.c.
+ *
+ * Searches a seed for which the hash of mime.c puts every extension below
+ * in a slot of its own, and prints the table as a header. Plain C, so it
+ * runs on the build host when cross compiling. Not installed; after
+ * changing the list:
+ *
+ *   make mimegen && ./mimegen > $(top_srcdir)/include/mime-table.h
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+// system include files, between < >
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct
+{
+    const char *ext;
+    const char *type;
+} MimeType;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define SLOT_BITS   7
+#define SLOTS       (1 << SLOT_BITS)
+#define MAX_SEED    0x10000000u
+#define MAX_EXT     16
+
+static const MimeType types[] =
+{
+    { "htm",      "text/html" },
+    { "html",     "text/html" },
+    { "shtml",    "text/html" },
+    { "xhtml",    "application/xhtml+xml" },
+    { "xht",      "application/xhtml+xml" },
+    { "xml",      "application/xml" },
+    { "xsl",      "application/xslt+xml" },
+    { "xslt",     "application/xslt+xml" },
+    { "dtd",      "application/xml-dtd" },
+    { "css",      "text/css" },
+    { "js",       "application/javascript" },
+    { "mjs",      "application/javascript" },
+    { "json",     "application/json" },
+    { "txt",      "text/plain" },
+    { "text",     "text/plain" },
+    { "csv",      "text/csv" },
+    { "appcache", "text/cache-manifest" },
+    { "manifest", "text/cache-manifest" },
+    { "svg",      "image/svg+xml" },
+    { "png",      "image/png" },
+    { "gif",      "image/gif" },
+    { "jpg",      "image/jpeg" },
+    { "jpeg",     "image/jpeg" },
+    { "jpe",      "image/jpeg" },
+    { "bmp",      "image/bmp" },
+    { "ico",      "image/x-icon" },
+    { "tif",      "image/tiff" },
+    { "tiff",     "image/tiff" },
+    { "webp",     "image/webp" },
+    { "mml",      "application/mathml+xml" },
+    { "rdf",      "application/rdf+xml" },
+    { "ncx",      "application/x-dtbncx+xml" },
+    { "opf",      "application/oebps-package+xml" },
+    { "pdf",      "application/pdf" },
+    { "epub",     "application/epub+zip" },
+    { "zip",      "application/zip" },
+    { "swf",      "application/x-shockwave-flash" },
+    { "ttf",      "font/ttf" },
+    { "otf",      "font/otf" },
+    { "woff",     "font/woff" },
+    { "woff2",    "font/woff2" },
+    { "eot",      "application/vnd.ms-fontobject" },
+    { "mp3",      "audio/mpeg" },
+    { "ogg",      "audio/ogg" },
+    { "oga",      "audio/ogg" },
+    { "wav",      "audio/wav" },
+    { "m4a",      "audio/mp4" },
+    { "ogv",      "video/ogg" },
+    { "mp4",      "video/mp4" },
+    { "webm",     "video/webm" },
+};
+
+#define N_TYPES     (sizeof(types) / sizeof(types[0]))
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static unsigned int hash (const char *ext, unsigned int seed);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+int main(void)
+{
+    const MimeType *slots[SLOTS];
+    unsigned int   seed;
+    unsigned int   i;
+    size_t         max_len = 0;
+
+    for (seed = 1; seed < MAX_SEED; seed++)
+    {
+        memset(slots, 0, sizeof(slots));
+        for (i = 0; i < N_TYPES; i++)
+        {
+            unsigned int slot = hash(types[i].ext, seed);
+            if (slots[slot])
+            {
+                break;
+            }
+            slots[slot] = &types[i];
+        }
+        if (i == N_TYPES)
+        {
+            break;
+        }
+    }
+
+    if (seed == MAX_SEED)
+    {
+        fprintf(stderr, "no perfect hash in %u slots, raise SLOT_BITS\n", SLOTS);
+        return 1;
+    }
+
+    for (i = 0; i < N_TYPES; i++)
+    {
+        if (strlen(types[i].ext) > max_len)
+        {
+            max_len = strlen(types[i].ext);
+        }
+    }
+
+    printf("/*\n"
+           " * File Name  : mime-table.h\n"
+           " *\n"
+           " * Description: Content types by file extension, generated by mimegen;\n"
+           " *              do not edit\n"
+           " */\n"
+           "\n"
+           "#define MIME_SEED       0x%08xu\n"
+           "#define MIME_SLOT_BITS  %u\n"
+           "#define MIME_MAX_EXT    %u\n"
+           "\n"
+           "static const MimeType mime_table[1 << MIME_SLOT_BITS] =\n"
+           "{\n",
+           seed, SLOT_BITS, (unsigned int) max_len);
+    for (i = 0; i < SLOTS; i++)
+    {
+        if (slots[i])
+        {
+            char ext[MAX_EXT + 4];
+
+            snprintf(ext, sizeof(ext), "\"%s\",", slots[i]->ext);
+            printf("    [%3u] = { %-11s \"%s\" },\n", i, ext, slots[i]->type);
+        }
+    }
+    printf("};\n");
+
+    return 0;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+// FNV-1a on the lower case extension, top bits; must match mime_hash()
+static unsigned int hash(const char *ext, unsigned int seed)
+{
+    unsigned int h = seed;
+
+    while (*ext)
+    {
+        h = ((h ^ (unsigned char) tolower((unsigned char) *ext++)) * 16777619u) & 0xffffffffu;
+    }
+    return h >> (32 - SLOT_BITS);
+}
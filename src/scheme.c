@@ -0,0 +1,374 @@
+/*
+ * File Name: scheme.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+#ifdef HAVE_SOUP_REQUEST
+#define LIBSOUP_USE_UNSTABLE_REQUEST_API
+#include <libsoup/soup.h>
+#include <libsoup/soup-request.h>
+#include <gio/gio.h>
+#include <gio/gunixinputstream.h>
+#endif
+
+// local include files, between " "
+#include "log.h"
+#include "cache.h"
+#include "scheme.h"
+#include "server.h"
+
+
+#ifdef HAVE_SOUP_REQUEST
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+#define ZIP_TYPE_REQUEST        (zip_request_get_type())
+#define ZIP_REQUEST(obj)        (G_TYPE_CHECK_INSTANCE_CAST((obj), ZIP_TYPE_REQUEST, ZipRequest))
+
+typedef struct
+{
+    SoupRequest     parent;
+
+    GInputStream    *stream;        // until handed to the caller
+    goffset         length;
+    const gchar     *content_type;  // static, NULL when unknown
+    gboolean        done;           // for a synchronous send
+} ZipRequest;
+
+typedef struct
+{
+    SoupRequestClass parent_class;
+} ZipRequestClass;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define ENTRY_KEY       "zipbrowser-entry"
+
+static const char  *zip_schemes[] = { SCHEME_NAME, NULL };
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static void          zip_request_finalize       (GObject *object);
+static gboolean      zip_request_check_uri      (SoupRequest *request, SoupURI *uri, GError **error);
+static GInputStream *zip_request_send           (SoupRequest *request, GCancellable *cancellable, GError **error);
+static void          zip_request_send_async     (SoupRequest *request,
+                                                 GCancellable *cancellable,
+                                                 GAsyncReadyCallback callback,
+                                                 gpointer user_data);
+static GInputStream *zip_request_send_finish    (SoupRequest *request, GAsyncResult *result, GError **error);
+static goffset       zip_request_get_content_length(SoupRequest *request);
+static const char   *zip_request_get_content_type(SoupRequest *request);
+
+static gchar        *get_entry_url              (SoupRequest *request);
+static gboolean      set_diagnostics            (ZipRequest *zip, const gchar *url);
+static void          set_entry                  (ZipRequest *zip,
+                                                 CacheEntry *entry,
+                                                 gint fd,
+                                                 gsize size,
+                                                 const gchar *content_type);
+static void          sync_read_cb               (CacheEntry *entry,
+                                                 gint fd,
+                                                 gsize size,
+                                                 const gchar *content_type,
+                                                 gpointer user_data);
+static void          async_read_cb              (CacheEntry *entry,
+                                                 gint fd,
+                                                 gsize size,
+                                                 const gchar *content_type,
+                                                 gpointer user_data);
+
+G_DEFINE_TYPE(ZipRequest, zip_request, SOUP_TYPE_REQUEST)
+
+#endif /* HAVE_SOUP_REQUEST */
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gboolean scheme_init(SoupSession *session)
+{
+#ifdef HAVE_SOUP_REQUEST
+    LOGPRINTF("entry");
+
+    g_return_val_if_fail(session, FALSE);
+
+    soup_session_add_feature_by_type(session, ZIP_TYPE_REQUEST);
+    return TRUE;
+#else
+    WARNPRINTF("built without libsoup requests, using HTTP");
+    return FALSE;
+#endif
+}
+
+
+gchar *scheme_get_uri(const gchar *archive)
+{
+    return g_strdup_printf(SCHEME_NAME "://%s" SERVER_FILES_MARKER, archive ? archive : "");
+}
+
+
+#ifdef HAVE_SOUP_REQUEST
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static void zip_request_init(ZipRequest *zip)
+{
+    zip->length = -1;
+}
+
+
+static void zip_request_class_init(ZipRequestClass *klass)
+{
+    GObjectClass     *object_class  = G_OBJECT_CLASS(klass);
+    SoupRequestClass *request_class = SOUP_REQUEST_CLASS(klass);
+
+    object_class->finalize = zip_request_finalize;
+
+    request_class->schemes            = zip_schemes;
+    request_class->check_uri          = zip_request_check_uri;
+    request_class->send               = zip_request_send;
+    request_class->send_async         = zip_request_send_async;
+    request_class->send_finish        = zip_request_send_finish;
+    request_class->get_content_length = zip_request_get_content_length;
+    request_class->get_content_type   = zip_request_get_content_type;
+}
+
+
+static void zip_request_finalize(GObject *object)
+{
+    ZipRequest *zip = ZIP_REQUEST(object);
+
+    if (zip->stream)
+    {
+        g_object_unref(zip->stream);
+    }
+    G_OBJECT_CLASS(zip_request_parent_class)->finalize(object);
+}
+
+
+static gboolean zip_request_check_uri(SoupRequest *request, SoupURI *uri, GError **error)
+{
+    return (uri->path
+            && (strstr(uri->path, SERVER_FILES_MARKER) != NULL
+                || strcmp(uri->path, SERVER_STATS_URL) == 0
+                || strcmp(uri->path, SERVER_ACCESSLOG_URL) == 0));
+}
+
+
+// Wait for the entry in a main context of our own, as a worker may have to
+// decompress it
+static GInputStream *zip_request_send(SoupRequest *request, GCancellable *cancellable, GError **error)
+{
+    ZipRequest   *zip     = ZIP_REQUEST(request);
+    gchar        *url     = get_entry_url(request);
+    GMainContext *context = g_main_context_new();
+    GInputStream *stream  = NULL;
+
+    g_main_context_push_thread_default(context);
+    zip->done = set_diagnostics(zip, url);
+    if (!zip->done && !server_read_entry(url, &sync_read_cb, zip))
+    {
+        zip->done = TRUE;
+    }
+    while (!zip->done)
+    {
+        g_main_context_iteration(context, TRUE);
+    }
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+    g_free(url);
+
+    stream      = zip->stream;
+    zip->stream = NULL;
+    if (stream == NULL)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "cannot read entry");
+    }
+    return stream;
+}
+
+
+static void zip_request_send_async(SoupRequest *request,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+    GSimpleAsyncResult *result = NULL;
+    gchar              *url    = get_entry_url(request);
+
+    result = g_simple_async_result_new(G_OBJECT(request), callback, user_data, zip_request_send_async);
+    if (set_diagnostics(ZIP_REQUEST(request), url))
+    {
+        g_simple_async_result_complete_in_idle(result);
+        g_object_unref(result);
+    }
+    else if (!server_read_entry(url, &async_read_cb, result))
+    {
+        g_simple_async_result_set_error(result, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no such entry");
+        g_simple_async_result_complete_in_idle(result);
+        g_object_unref(result);
+    }
+    g_free(url);
+}
+
+
+static GInputStream *zip_request_send_finish(SoupRequest *request, GAsyncResult *result, GError **error)
+{
+    ZipRequest   *zip    = ZIP_REQUEST(request);
+    GInputStream *stream = NULL;
+
+    if (g_simple_async_result_propagate_error(G_SIMPLE_ASYNC_RESULT(result), error))
+    {
+        return NULL;
+    }
+
+    stream      = zip->stream;
+    zip->stream = NULL;
+    return stream;
+}
+
+
+static goffset zip_request_get_content_length(SoupRequest *request)
+{
+    return ZIP_REQUEST(request)->length;
+}
+
+
+// NULL lets the caller sniff the content, as for HTTP without Content-Type
+static const char *zip_request_get_content_type(SoupRequest *request)
+{
+    return ZIP_REQUEST(request)->content_type;
+}
+
+
+// The path of the URI, without escapes, as server_read_entry() takes it
+static gchar *get_entry_url(SoupRequest *request)
+{
+    return g_uri_unescape_string(soup_request_get_uri(request)->path, NULL);
+}
+
+
+// Serve the statistics and access log without the HTTP daemon
+static gboolean set_diagnostics(ZipRequest *zip, const gchar *url)
+{
+    const gchar *content_type = NULL;
+    gsize       size          = 0;
+    gpointer    data          = NULL;
+
+    data = server_get_diagnostics(url, &size, &content_type);
+    if (data == NULL)
+    {
+        return FALSE;
+    }
+
+    zip->stream       = g_memory_input_stream_new_from_data(data, size, g_free);
+    zip->length       = size;
+    zip->content_type = content_type;
+    return TRUE;
+}
+
+
+// Wrap an entry in a stream, without copying a cached entry
+static void set_entry(ZipRequest *zip,
+                      CacheEntry *entry,
+                      gint fd,
+                      gsize size,
+                      const gchar *content_type)
+{
+    if (entry)
+    {
+        size        = cache_entry_get_size(entry);
+        zip->stream = g_memory_input_stream_new_from_data(cache_entry_get_data(entry), size, NULL);
+        g_object_set_data_full(G_OBJECT(zip->stream), ENTRY_KEY, entry, (GDestroyNotify) cache_entry_unref);
+    }
+    else if (fd >= 0)
+    {
+        zip->stream = g_unix_input_stream_new(fd, TRUE);
+    }
+    else
+    {
+        return;
+    }
+
+    zip->length       = size;
+    zip->content_type = content_type;
+}
+
+
+static void sync_read_cb(CacheEntry *entry,
+                         gint fd,
+                         gsize size,
+                         const gchar *content_type,
+                         gpointer user_data)
+{
+    ZipRequest *zip = user_data;
+
+    set_entry(zip, entry, fd, size, content_type);
+    zip->done = TRUE;
+}
+
+
+static void async_read_cb(CacheEntry *entry,
+                          gint fd,
+                          gsize size,
+                          const gchar *content_type,
+                          gpointer user_data)
+{
+    GSimpleAsyncResult *result  = user_data;
+    GObject            *request = g_async_result_get_source_object(G_ASYNC_RESULT(result));
+    ZipRequest         *zip     = ZIP_REQUEST(request);
+
+    set_entry(zip, entry, fd, size, content_type);
+    if (zip->stream == NULL)
+    {
+        g_simple_async_result_set_error(result, G_IO_ERROR, G_IO_ERROR_FAILED, "cannot read entry");
+    }
+
+    // may run within send_async(), which must not complete itself
+    g_simple_async_result_complete_in_idle(result);
+    g_object_unref(result);
+    g_object_unref(request);
+}
+
+#endif /* HAVE_SOUP_REQUEST */
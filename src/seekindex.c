@@ -0,0 +1,434 @@
+/*
+ * File Name: seekindex.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+// local include files, between " "
+#include "log.h"
+#include "seekindex.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+#define WINDOW_SIZE     32768       // largest deflate back-reference
+#define CHUNK_SIZE      16384       // compressed input per read
+
+typedef struct
+{
+    guint64 out;                    // offset in the uncompressed entry
+    guint64 in;                     // offset of the first complete byte in the compressed data
+    gint    bits;                   // number of bits of the preceding byte still to be used
+    guchar  window[WINDOW_SIZE];    // output preceding this point
+} SeekPoint;
+
+struct _SeekIndex
+{
+    guint64   data_offset;          // compressed data of the entry in the archive
+    guint64   size;                 // uncompressed size of the entry
+    GPtrArray *points;              // SeekPoint, ascending
+};
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static void add_point           (SeekIndex *index,
+                                 gint bits,
+                                 guint64 in,
+                                 guint64 out,
+                                 guint left,
+                                 const guchar *window);
+static const SeekPoint *find_point(const SeekIndex *index, guint64 offset);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+SeekIndex *seekindex_build(unzFile zip, gsize span, SeekIndexSink sink, gpointer user_data)
+{
+    SeekIndex          *index  = NULL;
+    guchar             *input  = NULL;
+    guchar             *window = NULL;
+    unz_file_info64    file_info;
+    z_stream           strm;
+    guint64            totin   = 0;
+    guint64            totout  = 0;
+    guint64            last    = 0;
+    uLong              crc     = crc32(0L, Z_NULL, 0);
+    gboolean           ok      = TRUE;
+    int                ret     = Z_OK;
+    int                len;
+
+    g_return_val_if_fail(zip, NULL);
+
+    if (unzGetCurrentFileInfo64(zip, &file_info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK
+        || file_info.compression_method != Z_DEFLATED)
+    {
+        return NULL;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+    {
+        return NULL;
+    }
+
+    index              = g_new0(SeekIndex, 1);
+    index->data_offset = unzGetCurrentFileZStreamPos64(zip);
+    index->points      = g_ptr_array_new();
+    input              = g_malloc(CHUNK_SIZE);
+    window             = g_malloc0(WINDOW_SIZE);
+
+    // decompression can always start at the beginning of the entry
+    add_point(index, 0, 0, 0, WINDOW_SIZE, window);
+
+    // inflate into a circular window, stopping at each block boundary
+    do
+    {
+        if (strm.avail_in == 0)
+        {
+            len = unzReadCurrentFile(zip, input, CHUNK_SIZE);
+            if (len <= 0)
+            {
+                ret = Z_DATA_ERROR;     // truncated entry or read error
+                break;
+            }
+            strm.avail_in = len;
+            strm.next_in  = input;
+        }
+
+        do
+        {
+            guchar *start;
+
+            if (strm.avail_out == 0)
+            {
+                strm.avail_out = WINDOW_SIZE;
+                strm.next_out  = window;
+            }
+            start = strm.next_out;
+
+            totin  += strm.avail_in;
+            totout += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            totin  -= strm.avail_in;
+            totout -= strm.avail_out;
+
+            if (ret == Z_NEED_DICT)
+            {
+                ret = Z_DATA_ERROR;
+            }
+            if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+            {
+                break;
+            }
+
+            if (strm.next_out > start)
+            {
+                gsize produced = strm.next_out - start;
+                crc = crc32(crc, start, produced);
+                if (sink && !sink(start, produced, user_data))
+                {
+                    ok = FALSE;
+                    break;
+                }
+            }
+
+            if (ret == Z_STREAM_END)
+            {
+                break;
+            }
+
+            // at the end of a block that is not the last one
+            if ((strm.data_type & 128) && !(strm.data_type & 64)
+                && totout - last > span)
+            {
+                add_point(index, strm.data_type & 7, totin, totout, strm.avail_out, window);
+                last = totout;
+            }
+        } while (strm.avail_in != 0);
+    } while (ok && ret != Z_STREAM_END && ret != Z_DATA_ERROR && ret != Z_MEM_ERROR);
+
+    inflateEnd(&strm);
+    g_free(window);
+    g_free(input);
+
+    if (ok && ret == Z_STREAM_END
+        && (totout != file_info.uncompressed_size || crc != file_info.crc))
+    {
+        WARNPRINTF("entry size or CRC mismatch");
+        ret = Z_DATA_ERROR;
+    }
+
+    if (!ok || ret != Z_STREAM_END)
+    {
+        if (ok)
+        {
+            WARNPRINTF("cannot decompress entry, error [%d]", ret);
+        }
+        seekindex_free(index);
+        return NULL;
+    }
+
+    index->size = totout;
+    LOGPRINTF("%u index points for %" G_GUINT64_FORMAT " bytes", index->points->len, index->size);
+    return index;
+}
+
+
+gssize seekindex_read(const SeekIndex *index,
+                      const gchar     *archive,
+                      guint64         offset,
+                      guchar          *buf,
+                      gsize           len)
+{
+    const SeekPoint *point   = NULL;
+    FILE            *file    = NULL;
+    guchar          *input   = NULL;
+    guchar          *discard = NULL;
+    z_stream        strm;
+    guint64         skip;
+    gboolean        skipping = TRUE;
+    int             ret      = Z_OK;
+    int             ch;
+
+    g_return_val_if_fail(index && archive && buf, -1);
+
+    if (offset >= index->size || len == 0)
+    {
+        return 0;
+    }
+
+    point = find_point(index, offset);
+    if (point == NULL)
+    {
+        return -1;
+    }
+
+    file = fopen(archive, "rb");
+    if (file == NULL)
+    {
+        ERRNOPRINTF("cannot open [%s]", archive);
+        return -1;
+    }
+    if (fseeko(file, index->data_offset + point->in - (point->bits ? 1 : 0), SEEK_SET) != 0)
+    {
+        ERRNOPRINTF("cannot seek in [%s]", archive);
+        fclose(file);
+        return -1;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    if (point->bits)
+    {
+        ch = getc(file);
+        if (ch == EOF)
+        {
+            inflateEnd(&strm);
+            fclose(file);
+            return -1;
+        }
+        inflatePrime(&strm, point->bits, ch >> (8 - point->bits));
+    }
+    if (point->out > 0)
+    {
+        inflateSetDictionary(&strm, point->window, WINDOW_SIZE);
+    }
+
+    input   = g_malloc(CHUNK_SIZE);
+    discard = g_malloc(WINDOW_SIZE);
+    skip    = offset - point->out;
+
+    // inflate and discard up to offset, then inflate into buf
+    do
+    {
+        if (skip == 0 && skipping)
+        {
+            strm.avail_out = len;
+            strm.next_out  = buf;
+            skipping       = FALSE;
+        }
+        if (skip > WINDOW_SIZE)
+        {
+            strm.avail_out = WINDOW_SIZE;
+            strm.next_out  = discard;
+            skip          -= WINDOW_SIZE;
+        }
+        else if (skip > 0)
+        {
+            strm.avail_out = (uInt) skip;
+            strm.next_out  = discard;
+            skip           = 0;
+        }
+
+        do
+        {
+            if (strm.avail_in == 0)
+            {
+                strm.avail_in = fread(input, 1, CHUNK_SIZE, file);
+                if (strm.avail_in == 0)
+                {
+                    ret = Z_DATA_ERROR;
+                    break;
+                }
+                strm.next_in = input;
+            }
+            ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT)
+            {
+                ret = Z_DATA_ERROR;
+            }
+        } while (strm.avail_out != 0 && ret == Z_OK);
+    } while (skipping && ret == Z_OK);
+
+    inflateEnd(&strm);
+    g_free(discard);
+    g_free(input);
+    fclose(file);
+
+    if (ret != Z_OK && ret != Z_STREAM_END)
+    {
+        WARNPRINTF("cannot decompress [%s] at %" G_GUINT64_FORMAT ", error [%d]", archive, offset, ret);
+        return -1;
+    }
+
+    return skipping ? 0 : (gssize) (len - strm.avail_out);
+}
+
+
+void seekindex_free(SeekIndex *index)
+{
+    guint i;
+
+    if (index == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < index->points->len; i++)
+    {
+        g_free(g_ptr_array_index(index->points, i));
+    }
+    g_ptr_array_free(index->points, TRUE);
+    g_free(index);
+}
+
+
+guint64 seekindex_get_size(const SeekIndex *index)
+{
+    return index->size;
+}
+
+
+guint seekindex_get_points(const SeekIndex *index)
+{
+    return index->points->len;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+// left is the number of unused bytes at the end of the circular window
+static void add_point(SeekIndex *index,
+                      gint bits,
+                      guint64 in,
+                      guint64 out,
+                      guint left,
+                      const guchar *window)
+{
+    SeekPoint *point = g_new(SeekPoint, 1);
+
+    point->out  = out;
+    point->in   = in;
+    point->bits = bits;
+
+    // unroll the circular window, oldest byte first
+    if (left)
+    {
+        memcpy(point->window, window + WINDOW_SIZE - left, left);
+    }
+    if (left < WINDOW_SIZE)
+    {
+        memcpy(point->window + left, window, WINDOW_SIZE - left);
+    }
+
+    g_ptr_array_add(index->points, point);
+}
+
+
+// Find the last index point at or before offset
+static const SeekPoint *find_point(const SeekIndex *index, guint64 offset)
+{
+    guint lo = 0;
+    guint hi = index->points->len;
+
+    if (hi == 0)
+    {
+        return NULL;
+    }
+
+    while (hi - lo > 1)
+    {
+        guint            mid   = (lo + hi) / 2;
+        const SeekPoint *point = g_ptr_array_index(index->points, mid);
+        if (point->out <= offset)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return g_ptr_array_index(index->points, lo);
+}
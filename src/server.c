@@ -0,0 +1,2888 @@
+/*
+ * File Name: server.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <time.h>
+#include <microhttpd.h>
+
+// local include files, between " "
+#include "log.h"
+#include "accesslog.h"
+#include "archive.h"
+#include "cache.h"
+#include "linkscan.h"
+#include "seekindex.h"
+#include "server.h"
+#include "spill.h"
+#include "stats.h"
+#include "unzip.h"
+#include "verify.h"
+#include "workers.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+#if MHD_VERSION >= 0x00097002
+typedef enum MHD_Result mhd_result_t;
+#else
+typedef int mhd_result_t;
+#endif
+
+// Worker priorities, by what the page waits for before its first layout
+typedef enum
+{
+    PRIORITY_DOCUMENT = 0,          // pages, and whatever the user opened
+    PRIORITY_STYLE,                 // stylesheets and fonts
+    PRIORITY_SCRIPT,
+    PRIORITY_MEDIA,                 // images, audio, video and the rest
+    PRIORITY_PREFETCH               // entries no one asked for yet
+} ReadPriority;
+
+// A satisfiable byte range of an entry
+typedef struct
+{
+    guint64         first;
+    guint64         length;
+} ByteRange;
+
+// An entry decompressed by a worker while its connection is suspended, or
+// for server_read_entry(); also carries entries found in cache or spill
+typedef struct
+{
+    struct MHD_Connection *connection;
+    gint            socket;         // of the connection, -1 without one
+    gint            generation;     // of server_cancel_reads() when requested
+    gboolean        cancelled;      // given up before it was read
+    ServerEntryFunc callback;       // without a connection, called in context
+    gpointer        user_data;
+    GMainContext    *context;
+    Archive         *archive;
+    gchar           *name;
+    ArchiveEntryInfo info;          // as resolved in the archive index
+    gint            crc_policy;
+    ReadPriority    priority;
+    gint64          started;        // stats_get_time() of the request, or 0
+    gint64          queued;         // when handed to the workers
+    gsize           size;
+    SpillFile       *spill;         // pending spill file, or NULL
+    gboolean        build_seek;     // inflate raw, recording seek index points
+    GArray          *ranges;        // ByteRange requested, or NULL for all
+    gboolean        map_stored;     // locate stored data in the archive file
+    gboolean        read_ranges;    // decompress the ranges from seek points
+    gboolean        cached;         // entry was found in the cache
+    gboolean        scan_links;     // prefetch what the entry refers to
+    gboolean        prefetch;       // only decompress into the cache
+    gboolean        running;        // prefetch started on a worker
+    GSList          *waiters;       // ReadJob attached to a running prefetch
+    guint           links;          // prefetch jobs queued by a scan
+
+    // results, handed back when the connection is resumed
+    CacheEntry      *entry;
+    gint            fd;
+    guint64         fd_base;        // offset of the entry data in fd
+    guchar          *range_data;    // the ranges decompressed back to back
+    SeekIndex       *seek;
+} ReadJob;
+
+// Body of a 206 response: the ranges of an entry, as multipart/byteranges
+// when there are several
+typedef struct
+{
+    GArray          *ranges;        // ByteRange
+    gchar           **headers;      // part headers, or NULL for a single range
+    gchar           *trailer;       // closing boundary, or NULL
+    CacheEntry      *entry;         // the data: a cached entry,
+    gint            fd;             // a file with the entry at fd_base,
+    guint64         fd_base;
+    guchar          *data;          // or the ranges back to back
+} RangeBody;
+
+// Response to an entry found in the cache, queued again as long as the
+// cache returns that entry for the same archive index
+typedef struct
+{
+    gchar           *archive;
+    guint           archive_id;     // see archive_get_id()
+    gchar           *name;
+    const CacheEntry *entry;        // held by the response
+    struct MHD_Response *response;
+} HotResponse;
+
+// Drives the daemon from the GLib main loop
+typedef struct
+{
+    GSource         source;
+    GPollFD         *fds;           // sockets polled for the daemon
+    guint           n_fds;
+} ServerSource;
+
+// Archive handle of a worker thread
+typedef struct
+{
+    gchar           *archive;
+    guint           archive_id;     // see archive_get_id()
+    unzFile         zip;
+    unz_crc_stats   crc_reported;   // part of the CRC statistics already added
+} Reader;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define FILES_MARKER    SERVER_FILES_MARKER
+#define VERSION_PREFIX  "__V"           // <archive>/__FILES/__V<version>/<entry>
+#define CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#define SPILL_CHUNK     (64 * 1024)
+#define ETAG_SIZE       80
+#define HTTP_DATE_SIZE  32
+#define MAX_RANGES      16              // more are served as a whole entry
+#define RANGE_DECODE_MAX (4 * 1024 * 1024)  // larger ranges decompress the entire entry
+#define RANGE_BLOCK     (32 * 1024)
+#define HOT_RESPONSES   32              // pre-built responses kept
+#define HOT_MAX_SIZE    (256 * 1024)    // larger entries are not worth pinning
+#define PREFETCH_SCAN_MAX   (512 * 1024)    // of a document, scanned for links
+#define PREFETCH_MAX_LINKS  32              // entries prefetched per document
+
+#ifndef MHD_HTTP_RANGE_NOT_SATISFIABLE
+#define MHD_HTTP_RANGE_NOT_SATISFIABLE  MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE
+#endif
+
+// main loop priorities of the server, while the browser is idle or
+// waiting for a page; while loading it goes before redraws
+#define SOURCE_PRIORITY_IDLE        G_PRIORITY_DEFAULT
+#define SOURCE_PRIORITY_LOADING     G_PRIORITY_HIGH
+
+#if MHD_VERSION >= 0x00095300
+#define SERVER_SUSPEND_RESUME   MHD_ALLOW_SUSPEND_RESUME
+#else
+#define SERVER_SUSPEND_RESUME   MHD_USE_SUSPEND_RESUME
+#endif
+
+static const char  *file_not_found = "<html><body>File not found</body></html>";
+
+// HTTP dates are in English, whatever the locale
+static const char  *week_days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char  *months[]    = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static struct MHD_Daemon *g_daemon       = NULL;
+static struct MHD_Response *g_not_found  = NULL;    // queued for every miss
+static ServerConfig      g_config;                  // as started, for the statistics
+static guint16           g_port          = SERVER_DEFAULT_PORT;
+static gboolean          g_spill_enabled = FALSE;
+static gchar             *g_password     = NULL;    // for AES encrypted entries
+static GSource           *g_source       = NULL;    // in main loop mode
+
+static gint              g_headers_seen;            // *ptr of a request before it is handled
+
+static GStaticMutex      g_crc_mutex     = G_STATIC_MUTEX_INIT;
+static unz_crc_stats     g_crc_stats;               // of reads finished before
+
+static GStaticMutex      g_hot_mutex     = G_STATIC_MUTEX_INIT;
+static GQueue            g_hot           = G_QUEUE_INIT;    // HotResponse, most recent first
+static guint64           g_hot_reused    = 0;
+
+static GStaticMutex      g_prefetch_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable        *g_prefetching  = NULL;    // "<archive id>:<entry>" being prefetched
+static volatile gint     g_prefetched    = 0;       // prefetch jobs queued
+
+static volatile gint     g_generation    = 0;       // bumped by server_cancel_reads()
+static volatile gint     g_cancelled     = 0;       // reads given up
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static mhd_result_t serve_http      (void *cls,
+                                     struct MHD_Connection *connection,
+                                     const char *url,
+                                     const char *method,
+                                     const char *version,
+                                     const char *upload_data,
+                                     size_t *upload_data_size,
+                                     void **ptr);
+
+static mhd_result_t serve_not_found (struct MHD_Connection *connection);
+static mhd_result_t serve_not_allowed(struct MHD_Connection *connection);
+static mhd_result_t serve_head      (struct MHD_Connection *connection, ReadJob *job);
+static ssize_t      head_read_cb    (void *cls, uint64_t pos, char *buf, size_t max);
+static gpointer     get_diagnostics (const gchar *url, gsize *size, const gchar **content_type);
+static mhd_result_t serve_diagnostics(struct MHD_Connection *connection, gpointer data, gsize size, const gchar *content_type);
+static GString     *get_stats       (void);
+static void         append_phase_stats(GString *text);
+static const gchar *format_hit_rate (gchar *buf, guint64 hits, guint64 misses);
+static void         log_access      (const ReadJob *job, guint status, AccessSource source, guint flags, guint64 size);
+static void         get_daemon_options(const ServerConfig *config, struct MHD_OptionItem *options);
+static mhd_result_t serve_job       (struct MHD_Connection *connection, ReadJob *job);
+static mhd_result_t serve_not_modified(struct MHD_Connection *connection, ReadJob *job);
+static mhd_result_t serve_not_satisfiable(struct MHD_Connection *connection, ReadJob *job);
+static gboolean     is_not_modified (struct MHD_Connection *connection, const ReadJob *job);
+static gint         get_ranges      (struct MHD_Connection *connection, ReadJob *job);
+static gint         parse_ranges    (const gchar *spec, guint64 size, GArray *ranges);
+static void         add_entry_headers(struct MHD_Response *response, const ReadJob *job);
+static void         get_etag        (const ReadJob *job, gchar *buf, gsize size);
+static gboolean     get_last_modified(guint32 dos_date, gchar *buf, gsize size);
+static void         request_completed(void *cls,
+                                     struct MHD_Connection *connection,
+                                     void **ptr,
+                                     enum MHD_RequestTerminationCode code);
+static void         entry_free_cb   (void *data);
+static gboolean     split_url       (const gchar *url, gchar **archive, gchar **version, const gchar **path);
+static gchar       *build_url       (const gchar *archive, const gchar *version, const gchar *path);
+static mhd_result_t serve_redirect  (struct MHD_Connection *connection, const gchar *location);
+static ReadJob     *resolve_entry   (const gchar *archive, const gchar *path);
+static ReadJob     *read_job_new    (Archive *archive, const gchar *name, const ArchiveEntryInfo *info);
+static void         find_entry      (ReadJob *job);
+static ReadPriority get_priority    (const gchar *content_type, gboolean top_level);
+static gint         get_crc_policy  (const Archive *archive);
+static struct MHD_Response *response_from_entry(CacheEntry *entry);
+static struct MHD_Response *response_from_fd(gint fd, gsize size);
+static struct MHD_Response *response_from_ranges(ReadJob *job);
+static gboolean     queue_hot_response(struct MHD_Connection *connection, const ReadJob *job, mhd_result_t *ret);
+static gboolean     keep_hot_response(const ReadJob *job, struct MHD_Response *response);
+static void         hot_response_free(HotResponse *hot);
+static void         hot_responses_clear(void);
+static ssize_t      range_body_read_cb(void *cls, uint64_t pos, char *buf, size_t max);
+static void         range_body_free_cb(void *cls);
+static guint64      get_ranges_length(const GArray *ranges);
+
+static gboolean     read_job_is_done(const ReadJob *job);
+static gboolean     read_job_is_cancelled(ReadJob *job);
+static void         read_job_submit (ReadJob *job);
+static void         read_job_finish (ReadJob *job);
+static void         read_job_store_seek(ReadJob *job);
+static void         read_job_free   (ReadJob *job);
+static void         run_read_job    (gpointer data, gpointer *context);
+static gboolean     read_job_done_cb(gpointer data);
+static void         prefetch_links  (const ReadJob *job);
+static void         scan_links      (ReadJob *job);
+static gboolean     prefetch_link_cb(const gchar *link, gpointer user_data);
+static gchar       *resolve_link    (const gchar *name, const gchar *link);
+static gchar       *get_prefetch_key(const ReadJob *job);
+static gboolean     prefetch_attach (ReadJob *job);
+static gboolean     prefetch_start  (ReadJob *job);
+static void         prefetch_done   (ReadJob *job);
+static unzFile      reader_open     (Reader *reader, const Archive *archive);
+static void         reader_report_crc(Reader *reader);
+static void         reader_free     (gpointer data);
+static void         add_crc_stats   (const unz_crc_stats *stats, const unz_crc_stats *base);
+static CacheEntry  *read_entry      (unzFile zip, const Archive *archive, const gchar *name, gsize size);
+static gint         spill_entry     (unzFile zip, ReadJob *job);
+static gint         spill_indexed_entry(unzFile zip, ReadJob *job);
+static gint         open_stored_entry(unzFile zip, const gchar *archive, guint64 *base);
+static guchar      *read_indexed_ranges(ReadJob *job);
+static gboolean     spill_write_cb  (const guchar *data, gsize len, gpointer user_data);
+
+static GSource     *server_source_new     (void);
+static gboolean     server_source_prepare (GSource *source, gint *timeout);
+static gboolean     server_source_check   (GSource *source);
+static gboolean     server_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data);
+static void         server_source_finalize(GSource *source);
+
+static GSourceFuncs server_source_funcs =
+{
+    server_source_prepare,
+    server_source_check,
+    server_source_dispatch,
+    server_source_finalize,
+    NULL,
+    NULL
+};
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gboolean server_start(const ServerConfig *config)
+{
+    struct MHD_OptionItem options[8];
+
+    LOGPRINTF("port [%d]", config->port);
+
+    g_return_val_if_fail(g_daemon == NULL, FALSE);
+
+    cache_init(config->cache_size);
+    g_spill_enabled = spill_init(config->spill_dir, config->spill_size);
+    verify_init(config->crc_mode, config->password);
+    memset(&g_crc_stats, 0, sizeof(g_crc_stats));
+    g_password = g_strdup(config->password);
+    archive_init(ARCHIVE_DEFAULT_OPEN);
+    accesslog_init(NULL);
+
+    g_static_mutex_lock(&g_prefetch_mutex);
+    g_prefetching = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_static_mutex_unlock(&g_prefetch_mutex);
+
+    if (!workers_init(0, &run_read_job, &reader_free))
+    {
+        ERRORPRINTF("cannot start decompression workers");
+        archive_destroy();
+        verify_destroy();
+        spill_destroy();
+        cache_destroy();
+        g_free(g_password);
+        g_password = NULL;
+        return FALSE;
+    }
+
+    g_port   = config->port;
+    g_config = *config;
+    g_config.spill_dir = NULL;
+    g_config.password  = NULL;
+    if (!config->http)
+    {
+        // entries are only read through server_read_entry()
+        return TRUE;
+    }
+
+    g_not_found = MHD_create_response_from_buffer(strlen(file_not_found),
+                                                  (void *) file_not_found,
+                                                  MHD_RESPMEM_PERSISTENT);
+    if (g_not_found)
+    {
+        MHD_add_response_header(g_not_found, MHD_HTTP_HEADER_CONTENT_TYPE, "text/html");
+    }
+
+    // polled by the main loop, where workers wake it through the daemon's
+    // resume pipe; or else with more than one thread, each runs its own
+    // select loop on the shared listening socket
+    memset(options, 0, sizeof(options));
+    get_daemon_options(config, options);
+    g_daemon = MHD_start_daemon((config->main_loop ? 0 : MHD_USE_SELECT_INTERNALLY) | SERVER_SUSPEND_RESUME,
+                                g_port,
+                                NULL, NULL,
+                                &serve_http, NULL,
+                                MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                                MHD_OPTION_ARRAY, options,
+                                MHD_OPTION_END);
+    if (g_daemon == NULL)
+    {
+        ERRORPRINTF("cannot start HTTP server on port [%d]", g_port);
+        if (g_not_found)
+        {
+            MHD_destroy_response(g_not_found);
+            g_not_found = NULL;
+        }
+        workers_destroy();
+        archive_destroy();
+        verify_destroy();
+        spill_destroy();
+        cache_destroy();
+        g_free(g_password);
+        g_password = NULL;
+        return FALSE;
+    }
+
+    if (config->main_loop)
+    {
+        g_source = server_source_new();
+        g_source_attach(g_source, NULL);
+    }
+
+    return TRUE;
+}
+
+
+void server_stop(void)
+{
+    LOGPRINTF("entry");
+
+    // finish queued reads, resuming their connections, before the daemon
+    // goes; it must not be stopped with suspended connections. Requests
+    // arriving meanwhile are read on their HTTP thread.
+    workers_destroy();
+
+    g_static_mutex_lock(&g_prefetch_mutex);
+    if (g_prefetching)
+    {
+        g_hash_table_destroy(g_prefetching);
+        g_prefetching = NULL;
+    }
+    g_static_mutex_unlock(&g_prefetch_mutex);
+
+    if (g_source)
+    {
+        g_source_destroy(g_source);
+        g_source_unref(g_source);
+        g_source = NULL;
+    }
+
+    if (g_daemon)
+    {
+        MHD_stop_daemon(g_daemon);
+        g_daemon = NULL;
+    }
+
+    if (g_not_found)
+    {
+        MHD_destroy_response(g_not_found);
+        g_not_found = NULL;
+    }
+    hot_responses_clear();
+
+    archive_destroy();
+
+    // the verifier may still invalidate cache and spill entries
+    verify_destroy();
+    spill_destroy();
+    g_spill_enabled = FALSE;
+    cache_destroy();
+    g_free(g_password);
+    g_password = NULL;
+}
+
+
+gchar *server_get_uri(const gchar *archive)
+{
+    Archive *handle = NULL;
+    gchar   *uri    = NULL;
+
+    // versioned, saving the redirect of serve_http()
+    handle = archive ? archive_open(archive) : NULL;
+    if (handle)
+    {
+        uri = build_url(archive, archive_get_version(handle), "/");
+        archive_unref(handle);
+        return uri;
+    }
+
+    return g_strdup_printf("http://127.0.0.1:%d%s" FILES_MARKER, g_port, archive ? archive : "");
+}
+
+
+gboolean server_read_entry(const gchar *url, ServerEntryFunc callback, gpointer user_data)
+{
+    gchar       *archive = NULL;
+    const gchar *path    = NULL;
+    ReadJob     *job     = NULL;
+
+    g_return_val_if_fail(url && callback, FALSE);
+
+    if (!split_url(url, &archive, NULL, &path))
+    {
+        return FALSE;
+    }
+    job = resolve_entry(archive, path);
+    g_free(archive);
+
+    if (job == NULL)
+    {
+        return FALSE;
+    }
+    job->started = stats_get_time();
+
+    find_entry(job);
+    if (read_job_is_done(job))
+    {
+        log_access(job, MHD_HTTP_OK, job->cached ? ACCESS_CACHE : ACCESS_SPILL, ACCESS_IN_PROCESS, job->size);
+        prefetch_links(job);
+        callback(job->entry, job->fd, job->size, job->info.content_type, user_data);
+        job->entry = NULL;
+        job->fd    = -1;
+        read_job_free(job);
+        return TRUE;
+    }
+
+    job->priority  = get_priority(job->info.content_type, FALSE);
+    job->callback  = callback;
+    job->user_data = user_data;
+    job->context   = g_main_context_get_thread_default();
+    job->context   = g_main_context_ref(job->context ? job->context : g_main_context_default());
+    read_job_submit(job);
+
+    return TRUE;
+}
+
+
+gpointer server_get_diagnostics(const gchar *url, gsize *size, const gchar **content_type)
+{
+    gint64   started = stats_get_time();
+    gpointer data    = NULL;
+
+    g_return_val_if_fail(url && size && content_type, NULL);
+
+    data = get_diagnostics(url, size, content_type);
+    if (data)
+    {
+        accesslog_add(url, 0, MHD_HTTP_OK, ACCESS_NONE, ACCESS_IN_PROCESS, *size, started);
+    }
+    return data;
+}
+
+
+void server_set_loading(gboolean loading)
+{
+    if (g_source)
+    {
+        g_source_set_priority(g_source, loading ? SOURCE_PRIORITY_LOADING : SOURCE_PRIORITY_IDLE);
+    }
+}
+
+
+void server_cancel_reads(void)
+{
+    LOGPRINTF("entry");
+
+    // jobs notice on the worker, before they start and between chunks
+    g_atomic_int_inc(&g_generation);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static mhd_result_t serve_http(void *cls,
+                               struct MHD_Connection *connection,
+                               const char *url,
+                               const char *method,
+                               const char *version,
+                               const char *upload_data,
+                               size_t *upload_data_size,
+                               void **ptr)
+{
+    const char          *file     = NULL;
+    gchar               *archive  = NULL;
+    gchar               *token    = NULL;
+    ReadJob             *job      = NULL;
+    gboolean            head      = FALSE;
+    gpointer            data      = NULL;
+    gsize               size      = 0;
+    const gchar         *type     = NULL;
+    gint64              started;
+    const union MHD_ConnectionInfo *info = NULL;
+    mhd_result_t        ret;
+
+    head = (0 == strcmp(method, MHD_HTTP_METHOD_HEAD));
+    if (!head && 0 != strcmp(method, MHD_HTTP_METHOD_GET))
+    {
+        started = stats_get_time();
+        ret     = serve_not_allowed(connection);
+        accesslog_add(url, 0, MHD_HTTP_METHOD_NOT_ALLOWED, ACCESS_NONE, 0, 0, started);
+        return ret;
+    }
+
+    // first call only sees the headers
+    if (*ptr == NULL)
+    {
+        *ptr = &g_headers_seen;
+        return MHD_YES;
+    }
+
+    // called again when a worker has resumed the connection
+    if (*ptr != &g_headers_seen)
+    {
+        job  = *ptr;
+        *ptr = NULL;
+        return serve_job(connection, job);
+    }
+    *ptr    = NULL;
+    started = stats_get_time();
+
+    data = get_diagnostics(url, &size, &type);
+    if (data)
+    {
+        ret = serve_diagnostics(connection, data, size, type);
+        accesslog_add(url, 0, MHD_HTTP_OK, ACCESS_NONE, 0, size, started);
+        return ret;
+    }
+
+    if (!split_url(url, &archive, &token, &file))
+    {
+        ret = serve_not_found(connection);
+        accesslog_add(url, 0, MHD_HTTP_NOT_FOUND, ACCESS_NONE, 0, 0, started);
+        return ret;
+    }
+    job = resolve_entry(archive, file);
+
+    // move into the namespace of the current archive contents, where every
+    // response may be cached for good
+    if (job && g_strcmp0(token, archive_get_version(job->archive)) != 0)
+    {
+        gchar *location = build_url(archive, archive_get_version(job->archive), file);
+        read_job_free(job);
+        g_free(token);
+        g_free(archive);
+
+        ret = serve_redirect(connection, location);
+        accesslog_add(url, 0, MHD_HTTP_FOUND, ACCESS_NONE, 0, 0, started);
+        g_free(location);
+        return ret;
+    }
+    g_free(token);
+    g_free(archive);
+
+    if (job == NULL)
+    {
+        ret = serve_not_found(connection);
+        accesslog_add(url, 0, MHD_HTTP_NOT_FOUND, ACCESS_NONE, 0, 0, started);
+        return ret;
+    }
+    job->started = started;
+
+    // the validators are in the index, no need to read the entry
+    if (is_not_modified(connection, job))
+    {
+        return serve_not_modified(connection, job);
+    }
+
+    // so are the headers of the entry
+    if (head)
+    {
+        return serve_head(connection, job);
+    }
+
+    if (get_ranges(connection, job) == 0)
+    {
+        return serve_not_satisfiable(connection, job);
+    }
+
+    find_entry(job);
+    if (job->cached && job->ranges == NULL && queue_hot_response(connection, job, &ret))
+    {
+        stats_add(STATS_REQUEST, job->started);
+        log_access(job, MHD_HTTP_OK, ACCESS_HOT, 0, job->size);
+        read_job_free(job);
+        return ret;
+    }
+    if (read_job_is_done(job))
+    {
+        return serve_job(connection, job);
+    }
+
+    // decompress on a worker; the connection sleeps until it is done.
+    // Without a referrer, the user opened the entry itself.
+    job->priority   = get_priority(job->info.content_type,
+                                   MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                               MHD_HTTP_HEADER_REFERER) == NULL);
+    job->connection = connection;
+    info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CONNECTION_FD);
+    if (info)
+    {
+        job->socket = info->connect_fd;
+    }
+    *ptr = job;
+    MHD_suspend_connection(connection);
+    read_job_submit(job);
+
+    return MHD_YES;
+}
+
+
+// Queue the result of a read job and free the job
+static mhd_result_t serve_job(struct MHD_Connection *connection, ReadJob *job)
+{
+    struct MHD_Response *response = NULL;
+    guint               status    = MHD_HTTP_OK;
+    AccessSource        source    = ACCESS_SPILL;
+    guint               flags     = job->ranges ? ACCESS_RANGE : 0;
+    guint64             size      = job->ranges ? get_ranges_length(job->ranges) : job->size;
+    mhd_result_t        ret;
+
+    read_job_store_seek(job);
+
+    if (job->queued)
+    {
+        source = ACCESS_WORKER;
+    }
+    else if (job->cached)
+    {
+        source = ACCESS_CACHE;
+    }
+
+    if (job->ranges)
+    {
+        response = response_from_ranges(job);
+        status   = MHD_HTTP_PARTIAL_CONTENT;
+    }
+    else if (job->entry)
+    {
+        // the response takes over our reference; job->entry stays valid
+        // as long as the response
+        response = response_from_entry(job->entry);
+        if (response == NULL)
+        {
+            job->entry = NULL;
+        }
+    }
+    else if (job->fd >= 0)
+    {
+        response = response_from_fd(job->fd, job->size);
+        job->fd  = -1;
+    }
+
+    if (response == NULL && job->cancelled)
+    {
+        // the client has gone, or will drop the answer; logged as status 0
+        log_access(job, 0, source, flags, 0);
+        read_job_free(job);
+        return MHD_NO;
+    }
+    if (response == NULL)
+    {
+        log_access(job, MHD_HTTP_NOT_FOUND, source, flags, 0);
+        read_job_free(job);
+        return serve_not_found(connection);
+    }
+
+    add_entry_headers(response, job);
+    ret = MHD_queue_response(connection, status, response);
+    if (job->started)
+    {
+        stats_add(STATS_REQUEST, job->started);
+    }
+    log_access(job, status, source, flags, size);
+    if (ret == MHD_YES && status == MHD_HTTP_OK)
+    {
+        prefetch_links(job);
+    }
+
+    // an entry requested again is likely to be requested once more
+    if (!(ret == MHD_YES && status == MHD_HTTP_OK && keep_hot_response(job, response)))
+    {
+        MHD_destroy_response(response);
+    }
+    job->entry = NULL;
+    read_job_free(job);
+
+    return ret;
+}
+
+
+static mhd_result_t serve_not_modified(struct MHD_Connection *connection, ReadJob *job)
+{
+    struct MHD_Response *response = NULL;
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL)
+    {
+        read_job_free(job);
+        return MHD_NO;
+    }
+
+    add_entry_headers(response, job);
+    log_access(job, MHD_HTTP_NOT_MODIFIED, ACCESS_INDEX, 0, 0);
+    read_job_free(job);
+
+    ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+static mhd_result_t serve_not_satisfiable(struct MHD_Connection *connection, ReadJob *job)
+{
+    struct MHD_Response *response = NULL;
+    gchar               buf[64];
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL)
+    {
+        read_job_free(job);
+        return MHD_NO;
+    }
+
+    g_snprintf(buf, sizeof(buf), "bytes */%" G_GUINT64_FORMAT, job->info.size);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, buf);
+    log_access(job, MHD_HTTP_RANGE_NOT_SATISFIABLE, ACCESS_INDEX, ACCESS_RANGE, 0);
+    read_job_free(job);
+
+    ret = MHD_queue_response(connection, MHD_HTTP_RANGE_NOT_SATISFIABLE, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+// Check the validators of a conditional GET; an ETag takes precedence
+static gboolean is_not_modified(struct MHD_Connection *connection, const ReadJob *job)
+{
+    const char *match = NULL;
+    const char *since = NULL;
+    gchar      buf[MAX(ETAG_SIZE, HTTP_DATE_SIZE)];
+
+    match = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
+    if (match)
+    {
+        get_etag(job, buf, sizeof(buf));
+        return (strcmp(match, "*") == 0 || strstr(match, buf) != NULL);
+    }
+
+    // clients echo Last-Modified back as is
+    since = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (since && get_last_modified(job->info.dos_date, buf, sizeof(buf)))
+    {
+        return (strcmp(since, buf) == 0);
+    }
+
+    return FALSE;
+}
+
+
+// Take the ranges of a Range header in job; returns the number of ranges,
+// -1 to send the whole entry, or 0 when none can be satisfied
+static gint get_ranges(struct MHD_Connection *connection, ReadJob *job)
+{
+    const char *spec     = NULL;
+    const char *if_range = NULL;
+    gchar      buf[MAX(ETAG_SIZE, HTTP_DATE_SIZE)];
+    gint       n;
+
+    spec = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_RANGE);
+    if (spec == NULL)
+    {
+        return -1;
+    }
+
+    // only ranges of the entry the client already has a part of
+    if_range = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_RANGE);
+    if (if_range)
+    {
+        get_etag(job, buf, sizeof(buf));
+        if (strcmp(if_range, buf) != 0
+            && !(get_last_modified(job->info.dos_date, buf, sizeof(buf)) && strcmp(if_range, buf) == 0))
+        {
+            return -1;
+        }
+    }
+
+    job->ranges = g_array_new(FALSE, FALSE, sizeof(ByteRange));
+    n = parse_ranges(spec, job->info.size, job->ranges);
+    if (n <= 0)
+    {
+        g_array_free(job->ranges, TRUE);
+        job->ranges = NULL;
+    }
+    return n;
+}
+
+
+// Parse "bytes=first-last, first-, -suffix, ..." into the ranges within
+// size; returns their number, 0 if none is, or -1 when spec is malformed
+// or has too many ranges
+static gint parse_ranges(const gchar *spec, guint64 size, GArray *ranges)
+{
+    const gchar *p   = NULL;
+    gchar       *end = NULL;
+    guint       n    = 0;
+    ByteRange   range;
+    guint64     first;
+    guint64     last;
+
+    if (!g_str_has_prefix(spec, "bytes="))
+    {
+        return -1;
+    }
+
+    for (p = spec + strlen("bytes="); *p; p++)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        if (*p == ',')
+        {
+            continue;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (++n > MAX_RANGES)
+        {
+            return -1;
+        }
+
+        if (*p == '-')
+        {
+            // the last bytes
+            if (!g_ascii_isdigit(p[1]))
+            {
+                return -1;
+            }
+            last = g_ascii_strtoull(p + 1, &end, 10);
+            if (last == 0 || size == 0)
+            {
+                p = end - 1;
+                continue;
+            }
+            first = (last < size) ? size - last : 0;
+            last  = size - 1;
+        }
+        else
+        {
+            if (!g_ascii_isdigit(*p))
+            {
+                return -1;
+            }
+            first = g_ascii_strtoull(p, &end, 10);
+            if (*end != '-')
+            {
+                return -1;
+            }
+            if (g_ascii_isdigit(end[1]))
+            {
+                last = g_ascii_strtoull(end + 1, &end, 10);
+                if (last < first)
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                last = G_MAXUINT64;
+                end++;
+            }
+            if (first >= size)
+            {
+                p = end - 1;
+                continue;
+            }
+            last = MIN(last, size - 1);
+        }
+
+        while (*end == ' ' || *end == '\t')
+        {
+            end++;
+        }
+        if (*end != ',' && *end != '\0')
+        {
+            return -1;
+        }
+
+        range.first  = first;
+        range.length = last - first + 1;
+        g_array_append_val(ranges, range);
+
+        p = end - 1;
+    }
+
+    return (n == 0) ? -1 : (gint) ranges->len;
+}
+
+
+static void add_entry_headers(struct MHD_Response *response, const ReadJob *job)
+{
+    gchar buf[MAX(ETAG_SIZE, HTTP_DATE_SIZE)];
+
+    // several ranges are sent as multipart, with the type in each part
+    if (job->info.content_type && !(job->ranges && job->ranges->len > 1))
+    {
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, job->info.content_type);
+    }
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCEPT_RANGES, "bytes");
+
+    // only served under the URL of the archive version, see serve_http()
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, CACHE_IMMUTABLE);
+
+    get_etag(job, buf, sizeof(buf));
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, buf);
+
+    if (get_last_modified(job->info.dos_date, buf, sizeof(buf)))
+    {
+        MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, buf);
+    }
+}
+
+
+// Strong validator: the archive contents, the entry CRC and its size
+static void get_etag(const ReadJob *job, gchar *buf, gsize size)
+{
+    g_snprintf(buf, size, "\"%s-%08x-%" G_GINT64_MODIFIER "x\"",
+               archive_get_version(job->archive),
+               job->info.crc,
+               job->info.size);
+}
+
+
+// Format the MS-DOS date of an entry, which is local time, as an HTTP date
+static gboolean get_last_modified(guint32 dos_date, gchar *buf, gsize size)
+{
+    struct tm tm;
+    time_t    t;
+
+    if (dos_date == 0)
+    {
+        return FALSE;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year  = ((dos_date >> 25) & 0x7f) + 80;
+    tm.tm_mon   = ((dos_date >> 21) & 0x0f) - 1;
+    tm.tm_mday  = (dos_date >> 16) & 0x1f;
+    tm.tm_hour  = (dos_date >> 11) & 0x1f;
+    tm.tm_min   = (dos_date >> 5) & 0x3f;
+    tm.tm_sec   = (dos_date & 0x1f) * 2;
+    tm.tm_isdst = -1;
+
+    t = mktime(&tm);
+    if (t == (time_t) -1 || gmtime_r(&t, &tm) == NULL)
+    {
+        return FALSE;
+    }
+
+    g_snprintf(buf, size, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+               week_days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+               tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return TRUE;
+}
+
+
+static mhd_result_t serve_redirect(struct MHD_Connection *connection, const gchar *location)
+{
+    struct MHD_Response *response = NULL;
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL)
+    {
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_LOCATION, location);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    ret = MHD_queue_response(connection, MHD_HTTP_FOUND, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+// Free a read job whose connection went away before it was served
+static void request_completed(void *cls,
+                              struct MHD_Connection *connection,
+                              void **ptr,
+                              enum MHD_RequestTerminationCode code)
+{
+    if (*ptr != NULL && *ptr != &g_headers_seen)
+    {
+        read_job_free(*ptr);
+    }
+    *ptr = NULL;
+}
+
+
+// Fill options, ending in MHD_OPTION_END, with the thread pool and the
+// limits of config that are set
+static void get_daemon_options(const ServerConfig *config, struct MHD_OptionItem *options)
+{
+    guint n = 0;
+
+    if (!config->main_loop)
+    {
+        options[n].option = MHD_OPTION_THREAD_POOL_SIZE;
+        options[n].value  = MAX(config->threads, 1);
+        n++;
+    }
+    if (config->connection_limit)
+    {
+        options[n].option = MHD_OPTION_CONNECTION_LIMIT;
+        options[n].value  = config->connection_limit;
+        n++;
+    }
+    if (config->connection_memory)
+    {
+        options[n].option = MHD_OPTION_CONNECTION_MEMORY_LIMIT;
+        options[n].value  = config->connection_memory;
+        n++;
+    }
+    if (config->timeout)
+    {
+        options[n].option = MHD_OPTION_CONNECTION_TIMEOUT;
+        options[n].value  = config->timeout;
+        n++;
+    }
+    if (config->listen_backlog)
+    {
+        options[n].option = MHD_OPTION_LISTEN_BACKLOG_SIZE;
+        options[n].value  = config->listen_backlog;
+        n++;
+    }
+    options[n].option = MHD_OPTION_END;
+}
+
+
+// Answer a miss with the shared response; the body is static
+static mhd_result_t serve_not_found(struct MHD_Connection *connection)
+{
+    if (g_not_found == NULL)
+    {
+        return MHD_NO;
+    }
+    return MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, g_not_found);
+}
+
+
+static mhd_result_t serve_not_allowed(struct MHD_Connection *connection)
+{
+    struct MHD_Response *response = NULL;
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL)
+    {
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ALLOW,
+                            MHD_HTTP_METHOD_GET ", " MHD_HTTP_METHOD_HEAD);
+    ret = MHD_queue_response(connection, MHD_HTTP_METHOD_NOT_ALLOWED, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+// Answer HEAD from the index: MHD sends the length of the response but
+// never reads its body
+static mhd_result_t serve_head(struct MHD_Connection *connection, ReadJob *job)
+{
+    struct MHD_Response *response = NULL;
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_callback(job->info.size, RANGE_BLOCK, &head_read_cb, NULL, NULL);
+    if (response == NULL)
+    {
+        read_job_free(job);
+        return MHD_NO;
+    }
+
+    add_entry_headers(response, job);
+    log_access(job, MHD_HTTP_OK, ACCESS_INDEX, ACCESS_HEAD, job->info.size);
+    read_job_free(job);
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+static ssize_t head_read_cb(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    return MHD_CONTENT_READER_END_WITH_ERROR;
+}
+
+
+static GString *get_stats(void)
+{
+    GString             *text     = g_string_new("");
+    CacheStats          stats;
+    SpillStats          spill;
+    VerifyStats         verify;
+    WorkerStats         workers;
+    unz_crc_stats       crc;
+    const union MHD_DaemonInfo *info = NULL;
+    gchar               cache_rate[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar               spill_rate[G_ASCII_DTOSTR_BUF_SIZE];
+
+    cache_get_stats(&stats);
+    spill_get_stats(&spill);
+    g_string_append_printf(text,
+                           "{\n"
+                           "  \"cache\": {\n"
+                           "    \"hits\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"misses\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"hit_rate\": %s,\n"
+                           "    \"insertions\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"evictions\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"rejected\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"entries\": %u,\n"
+                           "    \"bytes_used\": %lu,\n"
+                           "    \"budget\": %lu\n"
+                           "  },\n"
+                           "  \"spill\": {\n"
+                           "    \"hits\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"misses\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"hit_rate\": %s,\n"
+                           "    \"stores\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"evictions\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"files\": %u,\n"
+                           "    \"bytes_used\": %lu,\n"
+                           "    \"limit\": %lu\n"
+                           "  },\n",
+                           stats.hits,
+                           stats.misses,
+                           format_hit_rate(cache_rate, stats.hits, stats.misses),
+                           stats.insertions,
+                           stats.evictions,
+                           stats.rejected,
+                           stats.entries,
+                           (gulong) stats.bytes_used,
+                           (gulong) stats.budget,
+                           spill.hits,
+                           spill.misses,
+                           format_hit_rate(spill_rate, spill.hits, spill.misses),
+                           spill.stores,
+                           spill.evictions,
+                           spill.files,
+                           (gulong) spill.bytes_used,
+                           (gulong) spill.limit);
+
+    verify_get_stats(&verify);
+    g_static_mutex_lock(&g_crc_mutex);
+    crc = g_crc_stats;
+    g_static_mutex_unlock(&g_crc_mutex);
+    g_string_append_printf(text,
+                           "  \"crc\": {\n"
+                           "    \"policy\": \"%s\",\n"
+                           "    \"bytes_checked\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"bytes_skipped\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"time_us\": %" G_GUINT64_FORMAT "\n"
+                           "  },\n"
+                           "  \"verify\": {\n"
+                           "    \"verified\": %u,\n"
+                           "    \"failed\": %u,\n"
+                           "    \"pending\": %u,\n"
+                           "    \"bytes\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"time_us\": %" G_GUINT64_FORMAT "\n"
+                           "  },\n",
+                           verify_mode_name(verify.mode),
+                           (guint64) crc.bytes_checked,
+                           (guint64) crc.bytes_skipped,
+                           (guint64) crc.nsec / 1000,
+                           verify.verified,
+                           verify.failed,
+                           verify.pending,
+                           verify.bytes,
+                           verify.usec);
+
+    workers_get_stats(&workers);
+    g_string_append_printf(text,
+                           "  \"workers\": {\n"
+                           "    \"count\": %u,\n"
+                           "    \"jobs\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"steals\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"aged\": %" G_GUINT64_FORMAT ",\n"
+                           "    \"pending\": %u\n"
+                           "  },\n",
+                           workers.workers,
+                           workers.jobs,
+                           workers.steals,
+                           workers.aged,
+                           workers.pending);
+
+    info = g_daemon ? MHD_get_daemon_info(g_daemon, MHD_DAEMON_INFO_CURRENT_CONNECTIONS) : NULL;
+    g_string_append_printf(text,
+                           "  \"server\": {\n"
+                           "    \"port\": %u,\n"
+                           "    \"threads\": %u,\n"
+                           "    \"main_loop\": %s,\n"
+                           "    \"connections\": %u,\n"
+                           "    \"connection_limit\": %u,\n"
+                           "    \"connection_memory\": %lu,\n"
+                           "    \"timeout_s\": %u,\n"
+                           "    \"listen_backlog\": %u,\n"
+                           "    \"cancelled\": %d,\n"
+                           "    \"prefetched\": %d\n"
+                           "  },\n",
+                           g_config.port,
+                           g_config.main_loop ? 1 : MAX(g_config.threads, 1),
+                           g_config.main_loop ? "true" : "false",
+                           info ? info->num_connections : 0,
+                           g_config.connection_limit,
+                           (gulong) g_config.connection_memory,
+                           g_config.timeout,
+                           g_config.listen_backlog,
+                           g_atomic_int_get(&g_cancelled),
+                           g_atomic_int_get(&g_prefetched));
+
+    g_static_mutex_lock(&g_hot_mutex);
+    g_string_append_printf(text,
+                           "  \"responses\": {\n"
+                           "    \"hot\": %u,\n"
+                           "    \"reused\": %" G_GUINT64_FORMAT "\n"
+                           "  },\n",
+                           g_queue_get_length(&g_hot),
+                           g_hot_reused);
+    g_static_mutex_unlock(&g_hot_mutex);
+
+    append_phase_stats(text);
+    g_string_append(text, "}\n");
+
+    return text;
+}
+
+
+// The histograms of the phases of serving an entry, as the last member of
+// the statistics; a bucket is named by the time its samples are below
+static void append_phase_stats(GString *text)
+{
+    PhaseStats stats;
+    guint      phase;
+    guint      i;
+    gboolean   first;
+
+    g_string_append(text, "  \"phases\": {\n");
+    for (phase = 0; phase < STATS_PHASES; phase++)
+    {
+        stats_get_phase(phase, &stats);
+        g_string_append_printf(text,
+                               "    \"%s\": {\n"
+                               "      \"count\": %u,\n"
+                               "      \"total_us\": %" G_GUINT64_FORMAT ",\n"
+                               "      \"mean_us\": %" G_GUINT64_FORMAT ",\n"
+                               "      \"max_us\": %u,\n"
+                               "      \"histogram_us\": {",
+                               stats_phase_name(phase),
+                               stats.count,
+                               stats.total_us,
+                               stats.count ? stats.total_us / stats.count : 0,
+                               stats.max_us);
+
+        first = TRUE;
+        for (i = 0; i < STATS_BUCKETS; i++)
+        {
+            if (stats.buckets[i] == 0)
+            {
+                continue;
+            }
+            if (i < STATS_BUCKETS - 1)
+            {
+                g_string_append_printf(text, "%s \"%u\": %u", first ? "" : ",", 1u << i, stats.buckets[i]);
+            }
+            else
+            {
+                g_string_append_printf(text, "%s \"inf\": %u", first ? "" : ",", stats.buckets[i]);
+            }
+            first = FALSE;
+        }
+        g_string_append_printf(text, " }\n    }%s\n", (phase < STATS_PHASES - 1) ? "," : "");
+    }
+    g_string_append(text, "  }\n");
+}
+
+
+// Hits per lookup as a JSON number, whatever the locale
+static const gchar *format_hit_rate(gchar *buf, guint64 hits, guint64 misses)
+{
+    gdouble rate = (hits + misses) ? (gdouble) hits / (gdouble) (hits + misses) : 0.0;
+
+    return g_ascii_formatd(buf, G_ASCII_DTOSTR_BUF_SIZE, "%.4f", rate);
+}
+
+
+// The statistics as JSON, or the access log as accesslog_dump() writes it;
+// NULL for other URLs
+static gpointer get_diagnostics(const gchar *url, gsize *size, const gchar **content_type)
+{
+    GString    *text = NULL;
+    GByteArray *dump = NULL;
+
+    if (strcmp(url, SERVER_STATS_URL) == 0)
+    {
+        text          = get_stats();
+        *size         = text->len;
+        *content_type = "application/json";
+        return g_string_free(text, FALSE);
+    }
+    if (strcmp(url, SERVER_ACCESSLOG_URL) == 0)
+    {
+        dump          = accesslog_get_dump();
+        *size         = dump->len;
+        *content_type = "application/octet-stream";
+        return g_byte_array_free(dump, FALSE);
+    }
+    return NULL;
+}
+
+
+// Queue the data of get_diagnostics() and free it
+static mhd_result_t serve_diagnostics(struct MHD_Connection *connection,
+                                      gpointer data,
+                                      gsize size,
+                                      const gchar *content_type)
+{
+    struct MHD_Response *response = NULL;
+    mhd_result_t        ret;
+
+    response = MHD_create_response_from_buffer(size, data, MHD_RESPMEM_MUST_COPY);
+    g_free(data);
+    if (response == NULL)
+    {
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, content_type);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+
+// Add a request for an entry to the access log
+static void log_access(const ReadJob *job, guint status, AccessSource source, guint flags, guint64 size)
+{
+    accesslog_add(job->name, archive_get_id(job->archive), status, source, flags, size, job->started);
+}
+
+
+static void entry_free_cb(void *data)
+{
+    cache_entry_unref(cache_entry_from_data(data));
+}
+
+
+// Split <archive path>/__FILES/<entry name> into the archive path and the
+// entry name with a leading '/'
+static gboolean split_url(const gchar *url, gchar **archive, gchar **version, const gchar **path)
+{
+    const gchar *file = strstr(url, FILES_MARKER);
+    const gchar *end  = NULL;
+
+    if (file == NULL)
+    {
+        return FALSE;
+    }
+
+    *archive = g_strndup(url, file - url);
+    file += strlen(FILES_MARKER) - 1;   // keep leading '/'
+
+    // optional version token, up to the entry name
+    if (version)
+    {
+        *version = NULL;
+    }
+    if (g_str_has_prefix(file + 1, VERSION_PREFIX))
+    {
+        end = strchr(file + 1, '/');
+        if (end == NULL)
+        {
+            end = file + strlen(file);
+        }
+        if (version)
+        {
+            *version = g_strndup(file + 1 + strlen(VERSION_PREFIX),
+                                 end - file - 1 - strlen(VERSION_PREFIX));
+        }
+        file = (*end == '/') ? end : "/";
+    }
+
+    if (file[1] == '/')
+    {
+        file++; // skip double leading slash
+    }
+    *path = file;
+    return TRUE;
+}
+
+
+// Build the absolute URL of an entry in the namespace of an archive version
+static gchar *build_url(const gchar *archive, const gchar *version, const gchar *path)
+{
+    gchar *archive_esc = g_uri_escape_string(archive, "/", FALSE);
+    gchar *path_esc    = g_uri_escape_string(path, "/", FALSE);
+    gchar *url         = g_strdup_printf("http://127.0.0.1:%d%s" FILES_MARKER VERSION_PREFIX "%s%s",
+                                         g_port, archive_esc, version, path_esc);
+    g_free(path_esc);
+    g_free(archive_esc);
+    return url;
+}
+
+
+// Look an entry up in the archive index; returns a job without data, or
+// NULL when the archive has no such entry
+static ReadJob *resolve_entry(const gchar *archive, const gchar *path)
+{
+    Archive             *handle   = NULL;
+    const gchar         *name     = NULL;
+    ReadJob             *read_job = NULL;
+    ArchiveEntryInfo    info;
+    gint64              start;
+
+    handle = archive_open(archive);
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    start = stats_get_time();
+    name  = archive_resolve(handle, path, &info);
+    stats_add(STATS_LOOKUP, start);
+    if (name == NULL)
+    {
+        archive_unref(handle);
+        return NULL;
+    }
+
+    // the job owns our reference to the archive
+    read_job = read_job_new(handle, name, &info);
+
+    return read_job;
+}
+
+
+// Create a job without data for an entry; the job takes over a reference
+// to the archive
+static ReadJob *read_job_new(Archive *archive, const gchar *name, const ArchiveEntryInfo *info)
+{
+    ReadJob *read_job = g_new0(ReadJob, 1);
+
+    read_job->archive    = archive;
+    read_job->name       = g_strdup(name);
+    read_job->info       = *info;
+    read_job->size       = info->size;
+    read_job->fd         = -1;
+    read_job->socket     = -1;
+    read_job->generation = g_atomic_int_get(&g_generation);
+
+    return read_job;
+}
+
+
+// Find the entry of a job in the cache or spill directory, or else prepare
+// the job to decompress it
+static void find_entry(ReadJob *job)
+{
+    const gchar *archive = archive_get_path(job->archive);
+    const gchar *version = archive_get_version(job->archive);
+
+    job->entry = cache_lookup(archive, version, job->name);
+    if (job->entry)
+    {
+        job->cached = TRUE;
+        return;
+    }
+
+    if (g_spill_enabled)
+    {
+        job->fd = spill_open(archive, version, job->name, &job->size);
+        if (job->fd >= 0)
+        {
+            return;
+        }
+        job->size = job->info.size;
+    }
+
+    // serve ranges without decompressing the entire entry: stored data is
+    // read from the archive file, deflated data from the seek points
+    if (job->ranges && job->info.method == 0 && !job->info.encrypted)
+    {
+        job->map_stored = TRUE;
+        return;
+    }
+    if (job->ranges && job->info.indexed && get_ranges_length(job->ranges) <= RANGE_DECODE_MAX)
+    {
+        job->read_ranges = TRUE;
+        return;
+    }
+
+    job->crc_policy = get_crc_policy(job->archive);
+    if (g_spill_enabled && !cache_can_hold(job->size))
+    {
+        job->spill = spill_begin(archive, version, job->name, job->size);
+    }
+
+    // index a large deflated entry while it is spilled, inflating it ourselves
+    job->build_seek = (job->spill != NULL
+                       && !job->info.indexed
+                       && job->info.method == Z_DEFLATED
+                       && job->size > SEEKINDEX_DEFAULT_SPAN);
+}
+
+
+// Class of an entry by its content type; unknown types go last
+static ReadPriority get_priority(const gchar *content_type, gboolean top_level)
+{
+    if (top_level)
+    {
+        return PRIORITY_DOCUMENT;
+    }
+    if (content_type == NULL)
+    {
+        return PRIORITY_MEDIA;
+    }
+
+    if (g_str_has_prefix(content_type, "text/html")
+        || g_str_has_prefix(content_type, "application/xhtml+xml")
+        || g_str_has_prefix(content_type, "application/xml")
+        || g_str_has_prefix(content_type, "text/plain"))
+    {
+        return PRIORITY_DOCUMENT;
+    }
+    if (g_str_has_prefix(content_type, "text/css")
+        || g_str_has_prefix(content_type, "font/")
+        || g_str_has_prefix(content_type, "application/vnd.ms-fontobject"))
+    {
+        return PRIORITY_STYLE;
+    }
+    if (g_str_has_prefix(content_type, "application/javascript")
+        || g_str_has_prefix(content_type, "application/json"))
+    {
+        return PRIORITY_SCRIPT;
+    }
+    return PRIORITY_MEDIA;
+}
+
+
+// CRC policy for the archive file as it was opened, not as it is now
+static gint get_crc_policy(const Archive *archive)
+{
+    guint64 size;
+    gint64  mtime;
+
+    archive_get_file_stat(archive, &size, &mtime);
+    return verify_get_policy(archive_get_path(archive), size, mtime);
+}
+
+
+static struct MHD_Response *response_from_entry(CacheEntry *entry)
+{
+    // the response owns our reference, released in entry_free_cb()
+    struct MHD_Response *response = MHD_create_response_from_buffer_with_free_callback(
+                                            cache_entry_get_size(entry),
+                                            cache_entry_get_data(entry),
+                                            &entry_free_cb);
+    if (response == NULL)
+    {
+        cache_entry_unref(entry);
+    }
+    return response;
+}
+
+
+static struct MHD_Response *response_from_fd(gint fd, gsize size)
+{
+    // the response closes fd when it is destroyed
+    struct MHD_Response *response = MHD_create_response_from_fd64(size, fd);
+    if (response == NULL)
+    {
+        close(fd);
+    }
+    return response;
+}
+
+
+// Respond with the ranges of a job from its entry, file or decompressed
+// ranges, which the response takes over
+static struct MHD_Response *response_from_ranges(ReadJob *job)
+{
+    struct MHD_Response *response = NULL;
+    RangeBody           *body     = NULL;
+    ByteRange           *range    = NULL;
+    gchar               *boundary = NULL;
+    gchar               buf[64];
+    guint64             total     = 0;
+    guint               i;
+
+    if (!read_job_is_done(job))
+    {
+        return NULL;
+    }
+
+    range = &g_array_index(job->ranges, ByteRange, 0);
+    if (job->ranges->len == 1)
+    {
+        g_snprintf(buf, sizeof(buf), "bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+                   range->first, range->first + range->length - 1, job->info.size);
+
+        // a single range of a file is sent by the kernel
+        if (job->fd >= 0)
+        {
+            response = MHD_create_response_from_fd_at_offset64(range->length, job->fd,
+                                                               job->fd_base + range->first);
+            if (response == NULL)
+            {
+                return NULL;
+            }
+            job->fd = -1;
+            MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, buf);
+            return response;
+        }
+    }
+
+    body          = g_new0(RangeBody, 1);
+    body->ranges  = job->ranges;
+    body->entry   = job->entry;
+    body->fd      = job->fd;
+    body->fd_base = job->fd_base;
+    body->data    = job->range_data;
+    job->ranges     = NULL;
+    job->entry      = NULL;
+    job->fd         = -1;
+    job->range_data = NULL;
+
+    if (body->ranges->len > 1)
+    {
+        boundary      = g_strdup_printf("%08x%08x", g_random_int(), g_random_int());
+        body->headers = g_new0(gchar *, body->ranges->len + 1);
+        for (i = 0; i < body->ranges->len; i++)
+        {
+            range = &g_array_index(body->ranges, ByteRange, i);
+            body->headers[i] = g_strdup_printf("\r\n--%s\r\n"
+                                               "%s%s%s"
+                                               "Content-Range: bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT
+                                               "/%" G_GUINT64_FORMAT "\r\n\r\n",
+                                               boundary,
+                                               job->info.content_type ? "Content-Type: " : "",
+                                               job->info.content_type ? job->info.content_type : "",
+                                               job->info.content_type ? "\r\n" : "",
+                                               range->first, range->first + range->length - 1,
+                                               job->info.size);
+            total += strlen(body->headers[i]);
+        }
+        body->trailer = g_strdup_printf("\r\n--%s--\r\n", boundary);
+        total += strlen(body->trailer);
+    }
+    total += get_ranges_length(body->ranges);
+
+    response = MHD_create_response_from_callback(total, RANGE_BLOCK,
+                                                 &range_body_read_cb, body,
+                                                 &range_body_free_cb);
+    if (response == NULL)
+    {
+        range_body_free_cb(body);
+    }
+    else if (boundary)
+    {
+        gchar *type = g_strconcat("multipart/byteranges; boundary=", boundary, NULL);
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, type);
+        g_free(type);
+    }
+    else
+    {
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, buf);
+    }
+    g_free(boundary);
+
+    return response;
+}
+
+
+// Copy the body of a 206 response from pos: part headers, the range data
+// and the closing boundary, one piece per call
+static ssize_t range_body_read_cb(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    RangeBody       *body   = cls;
+    const ByteRange *range  = NULL;
+    guint64         offset  = 0;    // of the range in body->data
+    gsize           len;
+    ssize_t         ret;
+    guint           i;
+
+    for (i = 0; i < body->ranges->len; i++)
+    {
+        range = &g_array_index(body->ranges, ByteRange, i);
+
+        if (body->headers)
+        {
+            len = strlen(body->headers[i]);
+            if (pos < len)
+            {
+                len = MIN(len - pos, max);
+                memcpy(buf, body->headers[i] + pos, len);
+                return len;
+            }
+            pos -= len;
+        }
+
+        if (pos < range->length)
+        {
+            len = MIN(range->length - pos, max);
+            if (body->entry)
+            {
+                memcpy(buf, cache_entry_get_data(body->entry) + range->first + pos, len);
+            }
+            else if (body->data)
+            {
+                memcpy(buf, body->data + offset + pos, len);
+            }
+            else
+            {
+                ret = pread(body->fd, buf, len, body->fd_base + range->first + pos);
+                return (ret > 0) ? ret : MHD_CONTENT_READER_END_WITH_ERROR;
+            }
+            return len;
+        }
+        pos    -= range->length;
+        offset += range->length;
+    }
+
+    if (body->trailer && pos < strlen(body->trailer))
+    {
+        len = MIN(strlen(body->trailer) - pos, max);
+        memcpy(buf, body->trailer + pos, len);
+        return len;
+    }
+
+    return MHD_CONTENT_READER_END_OF_STREAM;
+}
+
+
+static void range_body_free_cb(void *cls)
+{
+    RangeBody *body = cls;
+
+    if (body->entry)
+    {
+        cache_entry_unref(body->entry);
+    }
+    if (body->fd >= 0)
+    {
+        close(body->fd);
+    }
+    g_strfreev(body->headers);
+    g_free(body->trailer);
+    g_free(body->data);
+    g_array_free(body->ranges, TRUE);
+    g_free(body);
+}
+
+
+static guint64 get_ranges_length(const GArray *ranges)
+{
+    guint64 total = 0;
+    guint   i;
+
+    for (i = 0; i < ranges->len; i++)
+    {
+        total += g_array_index(ranges, ByteRange, i).length;
+    }
+    return total;
+}
+
+
+// Queue the pre-built response to the cached entry of a job; FALSE when
+// there is none. Responses to stale entries of the archive are dropped.
+static gboolean queue_hot_response(struct MHD_Connection *connection, const ReadJob *job, mhd_result_t *ret)
+{
+    const gchar *archive = archive_get_path(job->archive);
+    guint       id       = archive_get_id(job->archive);
+    GList       *link    = NULL;
+    GList       *next    = NULL;
+    HotResponse *hot     = NULL;
+    gboolean    found    = FALSE;
+
+    g_static_mutex_lock(&g_hot_mutex);
+    for (link = g_hot.head; link; link = next)
+    {
+        next = link->next;
+        hot  = link->data;
+
+        if (strcmp(hot->archive, archive) != 0)
+        {
+            continue;
+        }
+        if (hot->archive_id != id || (strcmp(hot->name, job->name) == 0 && hot->entry != job->entry))
+        {
+            // indexed again, or invalidated in the cache
+            g_queue_delete_link(&g_hot, link);
+            hot_response_free(hot);
+        }
+        else if (hot->entry == job->entry)
+        {
+            // queue while the response cannot be dropped by another thread
+            *ret = MHD_queue_response(connection, MHD_HTTP_OK, hot->response);
+            g_queue_unlink(&g_hot, link);
+            g_queue_push_head_link(&g_hot, link);
+            g_hot_reused++;
+            found = TRUE;
+            break;
+        }
+    }
+    g_static_mutex_unlock(&g_hot_mutex);
+
+    return found;
+}
+
+
+// Keep a queued response to a cached entry for requests to come; the table
+// then owns the response. FALSE when it is not kept.
+static gboolean keep_hot_response(const ReadJob *job, struct MHD_Response *response)
+{
+    HotResponse *hot = NULL;
+
+    if (!job->cached || job->entry == NULL || job->size > HOT_MAX_SIZE)
+    {
+        return FALSE;
+    }
+
+    hot             = g_new0(HotResponse, 1);
+    hot->archive    = g_strdup(archive_get_path(job->archive));
+    hot->archive_id = archive_get_id(job->archive);
+    hot->name       = g_strdup(job->name);
+    hot->entry      = job->entry;
+    hot->response   = response;
+
+    g_static_mutex_lock(&g_hot_mutex);
+    g_queue_push_head(&g_hot, hot);
+    while (g_queue_get_length(&g_hot) > HOT_RESPONSES)
+    {
+        hot_response_free(g_queue_pop_tail(&g_hot));
+    }
+    g_static_mutex_unlock(&g_hot_mutex);
+
+    return TRUE;
+}
+
+
+// Drop a pre-built response, which lives on while it is being sent
+static void hot_response_free(HotResponse *hot)
+{
+    MHD_destroy_response(hot->response);
+    g_free(hot->archive);
+    g_free(hot->name);
+    g_free(hot);
+}
+
+
+static void hot_responses_clear(void)
+{
+    HotResponse *hot = NULL;
+
+    g_static_mutex_lock(&g_hot_mutex);
+    while ((hot = g_queue_pop_head(&g_hot)) != NULL)
+    {
+        hot_response_free(hot);
+    }
+    g_hot_reused = 0;
+    g_static_mutex_unlock(&g_hot_mutex);
+}
+
+
+static gboolean read_job_is_done(const ReadJob *job)
+{
+    return (job->entry != NULL || job->fd >= 0 || job->range_data != NULL);
+}
+
+
+// Worker thread: check whether a job is no longer wanted, because the
+// browser navigated away or the client closed its connection. A suspended
+// connection is not polled by MHD, so look at the socket ourselves.
+static gboolean read_job_is_cancelled(ReadJob *job)
+{
+    gchar   c;
+    ssize_t n;
+
+    if (job->cancelled)
+    {
+        return TRUE;
+    }
+
+    if (job->generation != g_atomic_int_get(&g_generation))
+    {
+        job->cancelled = TRUE;
+    }
+    else if (job->socket >= 0)
+    {
+        // end of file once the peer has closed; pipelined requests stay
+        n = recv(job->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        job->cancelled = (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+    }
+
+    if (job->cancelled)
+    {
+        LOGPRINTF("cancelled [%s]", job->name);
+        g_atomic_int_inc(&g_cancelled);
+    }
+    return job->cancelled;
+}
+
+
+// Run a job on a worker, or here when the workers are stopping
+static void read_job_submit(ReadJob *job)
+{
+    gpointer context = NULL;
+
+    job->queued = stats_get_time();
+    if (prefetch_attach(job))
+    {
+        return;
+    }
+    if (!workers_submit(job, job->priority))
+    {
+        run_read_job(job, &context);
+        if (context)
+        {
+            reader_free(context);
+        }
+    }
+}
+
+
+// Keep the seek points recorded by a job with its archive
+static void read_job_store_seek(ReadJob *job)
+{
+    if (job->seek)
+    {
+        archive_set_seek(job->archive, job->name, job->seek);
+        job->seek = NULL;
+    }
+}
+
+
+static void read_job_free(ReadJob *job)
+{
+    if (job->spill)
+    {
+        spill_abort(job->spill);
+    }
+    if (job->entry)
+    {
+        cache_entry_unref(job->entry);
+    }
+    if (job->fd >= 0)
+    {
+        close(job->fd);
+    }
+    if (job->context)
+    {
+        g_main_context_unref(job->context);
+    }
+    if (job->ranges)
+    {
+        g_array_free(job->ranges, TRUE);
+    }
+    g_free(job->range_data);
+    seekindex_free(job->seek);
+    archive_unref(job->archive);
+    g_free(job->name);
+    g_free(job);
+}
+
+
+// Worker thread: decompress the entry of a job into a cache entry or spill
+// file with the worker's own archive handle, then wake up the connection or
+// the main context of the caller
+static void run_read_job(gpointer data, gpointer *context)
+{
+    ReadJob  *job    = data;
+    Reader   *reader = *context;
+    unzFile  zip     = NULL;
+    gint64   start   = 0;
+
+    if (reader == NULL)
+    {
+        reader   = g_new0(Reader, 1);
+        *context = reader;
+    }
+
+    if (job->scan_links)
+    {
+        if (!read_job_is_cancelled(job))
+        {
+            scan_links(job);
+        }
+        read_job_free(job);
+        return;
+    }
+
+    if (job->prefetch && !prefetch_start(job))
+    {
+        read_job_free(job);
+        return;
+    }
+
+    if (job->queued)
+    {
+        stats_add(STATS_QUEUE, job->queued);
+    }
+
+    // decompressed meanwhile by a prefetch, or by a request for the same
+    // entry queued before this one
+    if (!job->read_ranges && !job->map_stored && job->spill == NULL)
+    {
+        job->entry  = cache_lookup(archive_get_path(job->archive),
+                                   archive_get_version(job->archive),
+                                   job->name);
+        job->cached = (job->entry != NULL);
+    }
+
+    // a cancelled job is handed back all the same, without data
+    if (job->read_ranges && !read_job_is_cancelled(job))
+    {
+        // from the seek points, without an archive handle
+        start           = stats_get_time();
+        job->range_data = read_indexed_ranges(job);
+        stats_add(STATS_INFLATE, start);
+    }
+    else if (!job->read_ranges && !job->cached && !read_job_is_cancelled(job))
+    {
+        zip = reader_open(reader, job->archive);
+    }
+
+    if (zip && unzGoToFilePos(zip, &job->info.pos) == UNZ_OK)
+    {
+        start = stats_get_time();
+        if (job->map_stored)
+        {
+            job->fd = open_stored_entry(zip, archive_get_path(job->archive), &job->fd_base);
+        }
+        else if (unzSetCrcPolicy(zip, job->crc_policy) == UNZ_OK
+                 && unzOpenCurrentFile3(zip, NULL, NULL, job->build_seek, g_password) == UNZ_OK)
+        {
+            if (job->spill)
+            {
+                // the spill file is committed or aborted either way
+                job->fd = job->build_seek ? spill_indexed_entry(zip, job)
+                                          : spill_entry(zip, job);
+                job->spill = NULL;
+            }
+            else
+            {
+                job->entry = read_entry(zip, job->archive, job->name, job->size);
+            }
+        }
+        stats_add(STATS_INFLATE, start);
+    }
+
+    if (zip)
+    {
+        reader_report_crc(reader);
+    }
+
+    read_job_finish(job);
+}
+
+
+// Hand a job back to whoever waits for it: its connection, the main
+// context of server_read_entry(), or the requests attached to a prefetch
+static void read_job_finish(ReadJob *job)
+{
+    if (job->connection)
+    {
+        MHD_resume_connection(job->connection);
+    }
+    else if (job->prefetch)
+    {
+        prefetch_done(job);
+    }
+    else
+    {
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, &read_job_done_cb, job, NULL);
+        g_source_attach(source, job->context);
+        g_source_unref(source);
+    }
+}
+
+
+// Hand the result of a job of server_read_entry() to its caller
+static gboolean read_job_done_cb(gpointer data)
+{
+    ReadJob *job = data;
+
+    read_job_store_seek(job);
+    log_access(job,
+               (job->entry || job->fd >= 0) ? MHD_HTTP_OK : MHD_HTTP_NOT_FOUND,
+               ACCESS_WORKER,
+               ACCESS_IN_PROCESS,
+               (job->entry || job->fd >= 0) ? job->size : 0);
+    prefetch_links(job);
+    job->callback(job->entry, job->fd, job->size, job->info.content_type, job->user_data);
+    job->entry = NULL;
+    job->fd    = -1;
+    read_job_free(job);
+
+    return FALSE;
+}
+
+
+// Have a worker scan a document in the cache for the entries it refers
+// to, so that they are decompressed before the browser asks for them
+static void prefetch_links(const ReadJob *job)
+{
+    const gchar *type = job->info.content_type;
+    ReadJob     *scan = NULL;
+
+    if (job->entry == NULL
+        || type == NULL
+        || !(g_str_has_prefix(type, "text/html")
+             || g_str_has_prefix(type, "application/xhtml+xml")
+             || g_str_has_prefix(type, "text/css")))
+    {
+        return;
+    }
+
+    scan             = read_job_new(archive_ref(job->archive), job->name, &job->info);
+    scan->entry      = cache_entry_ref(job->entry);
+    scan->generation = job->generation;
+    scan->scan_links = TRUE;
+    if (!workers_submit(scan, PRIORITY_DOCUMENT))
+    {
+        read_job_free(scan);
+    }
+}
+
+
+// Worker thread: queue prefetch jobs for the links of a document
+static void scan_links(ReadJob *job)
+{
+    LinkScanner *scanner = linkscan_new(&prefetch_link_cb, job);
+    gsize       len      = MIN(cache_entry_get_size(job->entry), PREFETCH_SCAN_MAX);
+
+    linkscan_feed(scanner, cache_entry_get_data(job->entry), len);
+    linkscan_free(scanner);
+}
+
+
+// Queue a job decompressing the entry a link of a document refers to into
+// the cache, unless it is there or on its way; other documents are left
+// for the user to open
+static gboolean prefetch_link_cb(const gchar *link, gpointer user_data)
+{
+    ReadJob          *job      = user_data;
+    const gchar      *archive  = archive_get_path(job->archive);
+    gchar            *path     = resolve_link(job->name, link);
+    const gchar      *name     = NULL;
+    ReadJob          *prefetch = NULL;
+    CacheEntry       *entry    = NULL;
+    gchar            *key      = NULL;
+    gboolean         queued    = FALSE;
+    ArchiveEntryInfo info;
+
+    name = path ? archive_resolve(job->archive, path, &info) : NULL;
+    g_free(path);
+    if (name == NULL
+        || get_priority(info.content_type, FALSE) == PRIORITY_DOCUMENT
+        || !cache_can_hold(info.size))
+    {
+        return TRUE;
+    }
+
+    entry = cache_lookup(archive, archive_get_version(job->archive), name);
+    if (entry)
+    {
+        cache_entry_unref(entry);
+        return TRUE;
+    }
+
+    prefetch             = read_job_new(archive_ref(job->archive), name, &info);
+    prefetch->prefetch   = TRUE;
+    prefetch->generation = job->generation;
+    prefetch->crc_policy = get_crc_policy(job->archive);
+    key = get_prefetch_key(prefetch);
+
+    g_static_mutex_lock(&g_prefetch_mutex);
+    if (g_prefetching && !g_hash_table_lookup(g_prefetching, key))
+    {
+        g_hash_table_insert(g_prefetching, key, prefetch);
+        queued = workers_submit(prefetch, PRIORITY_PREFETCH);
+        if (!queued)
+        {
+            g_hash_table_remove(g_prefetching, key);
+        }
+        key = NULL;
+    }
+    g_static_mutex_unlock(&g_prefetch_mutex);
+    g_free(key);
+
+    if (!queued)
+    {
+        read_job_free(prefetch);
+        return TRUE;
+    }
+
+    g_atomic_int_inc(&g_prefetched);
+    return (++job->links < PREFETCH_MAX_LINKS);
+}
+
+
+// Resolve a link relative to the entry name of a document into a path
+// with a leading '/', as archive_resolve() takes it; NULL when the link
+// leaves the archive
+static gchar *resolve_link(const gchar *name, const gchar *link)
+{
+    GPtrArray   *parts    = NULL;
+    gchar       **names   = NULL;
+    gchar       **links   = NULL;
+    gchar       *relative = NULL;
+    gchar       *path     = NULL;
+    GString     *result   = NULL;
+    gboolean    ok        = TRUE;
+    guint       i;
+
+    // other schemes, this page, and the root of the server
+    if (link[0] == '#' || link[0] == '/' || link[0] == '?'
+        || link[strcspn(link, ":/")] == ':')
+    {
+        return NULL;
+    }
+
+    relative = g_strndup(link, strcspn(link, "?#"));
+    path     = g_uri_unescape_string(relative, NULL);
+    g_free(relative);
+    if (path == NULL || path[0] == '\0')
+    {
+        g_free(path);
+        return NULL;
+    }
+
+    // the directory of the document, then the link
+    parts = g_ptr_array_new();
+    names = g_strsplit(name, "/", -1);
+    links = g_strsplit(path, "/", -1);
+    for (i = 0; names[i] && names[i + 1]; i++)
+    {
+        g_ptr_array_add(parts, names[i]);
+    }
+    for (i = 0; links[i] && ok; i++)
+    {
+        if (strcmp(links[i], "..") == 0)
+        {
+            ok = (parts->len > 0);
+            if (ok)
+            {
+                g_ptr_array_remove_index(parts, parts->len - 1);
+            }
+        }
+        else if (links[i][0] != '\0' && strcmp(links[i], ".") != 0)
+        {
+            g_ptr_array_add(parts, links[i]);
+        }
+    }
+
+    if (ok && parts->len > 0)
+    {
+        result = g_string_new("");
+        for (i = 0; i < parts->len; i++)
+        {
+            g_string_append_c(result, '/');
+            g_string_append(result, g_ptr_array_index(parts, i));
+        }
+    }
+
+    g_ptr_array_free(parts, TRUE);
+    g_strfreev(links);
+    g_strfreev(names);
+    g_free(path);
+
+    return result ? g_string_free(result, FALSE) : NULL;
+}
+
+
+static gchar *get_prefetch_key(const ReadJob *job)
+{
+    return g_strdup_printf("%u:%s", archive_get_id(job->archive), job->name);
+}
+
+
+// Let a request wait for the prefetch of its entry rather than decompress
+// it once more. A prefetch still queued behind the requests is taken over:
+// it is dropped and the request is read at its own priority.
+static gboolean prefetch_attach(ReadJob *job)
+{
+    ReadJob  *prefetch = NULL;
+    gchar    *key      = NULL;
+    gboolean attached  = FALSE;
+
+    if (job->prefetch || job->read_ranges || job->map_stored || job->spill)
+    {
+        return FALSE;
+    }
+
+    key = get_prefetch_key(job);
+    g_static_mutex_lock(&g_prefetch_mutex);
+    prefetch = g_prefetching ? g_hash_table_lookup(g_prefetching, key) : NULL;
+    if (prefetch && prefetch->running)
+    {
+        prefetch->waiters = g_slist_prepend(prefetch->waiters, job);
+        attached = TRUE;
+    }
+    else if (prefetch)
+    {
+        prefetch->cancelled = TRUE;
+        g_hash_table_remove(g_prefetching, key);
+    }
+    g_static_mutex_unlock(&g_prefetch_mutex);
+    g_free(key);
+
+    return attached;
+}
+
+
+// Worker thread: mark a prefetch as running, unless a request took it over
+static gboolean prefetch_start(ReadJob *job)
+{
+    gboolean start;
+
+    g_static_mutex_lock(&g_prefetch_mutex);
+    start = !job->cancelled;
+    job->running = start;
+    g_static_mutex_unlock(&g_prefetch_mutex);
+
+    return start;
+}
+
+
+// Worker thread: hand the entry of a prefetch to the requests attached to
+// it; when it failed, or was cancelled, they are read themselves
+static void prefetch_done(ReadJob *job)
+{
+    GSList  *waiters = NULL;
+    GSList  *iter    = NULL;
+    ReadJob *waiter  = NULL;
+    gchar   *key     = get_prefetch_key(job);
+
+    g_static_mutex_lock(&g_prefetch_mutex);
+    if (g_prefetching)
+    {
+        g_hash_table_remove(g_prefetching, key);
+    }
+    waiters      = job->waiters;
+    job->waiters = NULL;
+    g_static_mutex_unlock(&g_prefetch_mutex);
+    g_free(key);
+
+    for (iter = waiters; iter; iter = iter->next)
+    {
+        waiter = iter->data;
+        if (job->entry)
+        {
+            waiter->entry  = cache_entry_ref(job->entry);
+            waiter->cached = TRUE;
+            read_job_finish(waiter);
+        }
+        else
+        {
+            read_job_submit(waiter);
+        }
+    }
+    g_slist_free(waiters);
+
+    read_job_free(job);
+}
+
+
+// Open an archive with the handle of a worker, reusing the handle while it
+// is the same archive and has not been indexed again since
+static unzFile reader_open(Reader *reader, const Archive *archive)
+{
+    const gchar *path = archive_get_path(archive);
+    gint64      start;
+
+    if (reader->zip && reader->archive_id == archive_get_id(archive))
+    {
+        return reader->zip;
+    }
+
+    if (reader->zip)
+    {
+        unzClose(reader->zip);
+    }
+    g_free(reader->archive);
+
+    reader->archive    = g_strdup(path);
+    reader->archive_id = archive_get_id(archive);
+    start              = stats_get_time();
+    reader->zip        = unzOpen(path);
+    stats_add(STATS_OPEN, start);
+    memset(&reader->crc_reported, 0, sizeof(reader->crc_reported));
+
+    if (reader->zip == NULL)
+    {
+        WARNPRINTF("cannot open [%s]", path);
+    }
+    return reader->zip;
+}
+
+
+// Add what the worker's handle checked since the last report to the totals
+static void reader_report_crc(Reader *reader)
+{
+    unz_crc_stats crc_stats;
+
+    if (unzGetCrcStats(reader->zip, &crc_stats) == UNZ_OK)
+    {
+        add_crc_stats(&crc_stats, &reader->crc_reported);
+        reader->crc_reported = crc_stats;
+    }
+}
+
+
+static void reader_free(gpointer data)
+{
+    Reader *reader = data;
+
+    if (reader->zip)
+    {
+        unzClose(reader->zip);
+    }
+    g_free(reader->archive);
+    g_free(reader);
+}
+
+
+// Add stats minus base (when given) to the CRC totals
+static void add_crc_stats(const unz_crc_stats *stats, const unz_crc_stats *base)
+{
+    g_static_mutex_lock(&g_crc_mutex);
+    g_crc_stats.bytes_checked += stats->bytes_checked - (base ? base->bytes_checked : 0);
+    g_crc_stats.bytes_skipped += stats->bytes_skipped - (base ? base->bytes_skipped : 0);
+    g_crc_stats.nsec          += stats->nsec          - (base ? base->nsec          : 0);
+    g_static_mutex_unlock(&g_crc_mutex);
+}
+
+
+// Read the current file into a new cache entry and close it
+static CacheEntry *read_entry(unzFile zip, const Archive *archive, const gchar *name, gsize size)
+{
+    CacheEntry *entry = NULL;
+    int        err;
+    int        close_err;
+
+    entry = cache_entry_new(archive_get_path(archive), archive_get_version(archive), name, size);
+    if (entry == NULL)
+    {
+        unzCloseCurrentFile(zip);
+        return NULL;
+    }
+
+    err       = unzReadCurrentFileFully(zip, cache_entry_get_data(entry), size);
+    close_err = unzCloseCurrentFile(zip);
+    if (err == UNZ_OK)
+    {
+        err = close_err;
+    }
+
+    if (err == UNZ_CRCERROR)
+    {
+        // serve it as before, but don't keep a corrupted entry around
+        WARNPRINTF("entry [%s] read with error [%d]", name, err);
+    }
+    else if (err != UNZ_OK)
+    {
+        // an AES entry failing authentication is not served at all, the
+        // code is all that vouches for its plaintext
+        WARNPRINTF("cannot read [%s], error [%d]", name, err);
+        cache_entry_unref(entry);
+        return NULL;
+    }
+    else
+    {
+        cache_insert(entry);
+    }
+
+    return entry;
+}
+
+
+// Inflate the current file of a job into its spill file and close it,
+// giving up when the job is cancelled; returns a descriptor for reading
+// the spill file or -1 on error
+static gint spill_entry(unzFile zip, ReadJob *job)
+{
+    guchar *buf  = g_malloc(SPILL_CHUNK);
+    gint   out   = spill_file_get_fd(job->spill);
+    gsize  done  = 0;
+    int    len   = 0;
+    int    err;
+
+    while (done < job->size)
+    {
+        if (read_job_is_cancelled(job))
+        {
+            len = -1;
+            break;
+        }
+        len = unzReadCurrentFile(zip, buf, SPILL_CHUNK);
+        if (len <= 0)
+        {
+            break;
+        }
+        if (write(out, buf, len) != len)
+        {
+            ERRNOPRINTF("cannot spill [%s]", job->name);
+            len = -1;
+            break;
+        }
+        done += len;
+    }
+    g_free(buf);
+
+    err = unzCloseCurrentFile(zip);
+    if (done != job->size || err != UNZ_OK)
+    {
+        if (!job->cancelled)
+        {
+            WARNPRINTF("cannot read [%s], error [%d]", job->name, (len < 0) ? len : err);
+        }
+        spill_abort(job->spill);
+        return -1;
+    }
+
+    return spill_commit(job->spill);
+}
+
+
+// Inflate the raw current file of a job into its spill file, recording
+// seek index points on the way, and close it; returns a descriptor for
+// reading the spill file or -1 on error
+static gint spill_indexed_entry(unzFile zip, ReadJob *job)
+{
+    job->seek = seekindex_build(zip, SEEKINDEX_DEFAULT_SPAN, &spill_write_cb, job);
+    unzCloseCurrentFile(zip);
+
+    if (job->seek == NULL)
+    {
+        if (!job->cancelled)
+        {
+            WARNPRINTF("cannot read [%s]", job->name);
+        }
+        spill_abort(job->spill);
+        return -1;
+    }
+
+    return spill_commit(job->spill);
+}
+
+
+// Find the data of the current file, which must be stored without
+// encryption, in the archive file; returns a descriptor of the archive
+// file with the data at base, or -1 on error
+static gint open_stored_entry(unzFile zip, const gchar *archive, guint64 *base)
+{
+    gint method = 0;
+    gint fd;
+
+    if (unzOpenCurrentFile3(zip, &method, NULL, 1, NULL) != UNZ_OK)
+    {
+        return -1;
+    }
+    *base = unzGetCurrentFileZStreamPos64(zip);
+    unzCloseCurrentFile(zip);
+
+    fd = open(archive, O_RDONLY);
+    if (fd < 0)
+    {
+        ERRNOPRINTF("cannot open [%s]", archive);
+    }
+    return fd;
+}
+
+
+// Decompress the ranges of a job back to back from the seek points of its
+// entry; returns the data or NULL on error
+static guchar *read_indexed_ranges(ReadJob *job)
+{
+    guchar    *data   = g_try_malloc(get_ranges_length(job->ranges));
+    guint64   offset  = 0;
+    ByteRange *range  = NULL;
+    guint     i;
+
+    if (data == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < job->ranges->len; i++)
+    {
+        range = &g_array_index(job->ranges, ByteRange, i);
+        if (archive_read_indexed(job->archive, job->name, range->first,
+                                 data + offset, range->length) != (gssize) range->length)
+        {
+            WARNPRINTF("cannot read [%s] from seek points", job->name);
+            g_free(data);
+            return NULL;
+        }
+        offset += range->length;
+    }
+
+    return data;
+}
+
+
+static gboolean spill_write_cb(const guchar *data, gsize len, gpointer user_data)
+{
+    ReadJob *job = user_data;
+
+    if (read_job_is_cancelled(job))
+    {
+        return FALSE;
+    }
+    if (write(spill_file_get_fd(job->spill), data, len) != (ssize_t) len)
+    {
+        ERRNOPRINTF("cannot spill");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+static GSource *server_source_new(void)
+{
+    GSource      *source = g_source_new(&server_source_funcs, sizeof(ServerSource));
+    ServerSource *server = (ServerSource *) source;
+
+    // MHD only polls sockets below FD_SETSIZE
+    server->fds   = g_new0(GPollFD, FD_SETSIZE);
+    server->n_fds = 0;
+    g_source_set_priority(source, SOURCE_PRIORITY_IDLE);
+
+    return source;
+}
+
+
+// Poll the sockets the daemon waits for, until its next connection timeout
+static gboolean server_source_prepare(GSource *source, gint *timeout)
+{
+    ServerSource       *server = (ServerSource *) source;
+    fd_set             read_fds;
+    fd_set             write_fds;
+    fd_set             except_fds;
+    MHD_socket         max_fd  = 0;
+    unsigned long long ms      = 0;
+    guint              i;
+    gint               fd;
+
+    for (i = 0; i < server->n_fds; i++)
+    {
+        g_source_remove_poll(source, &server->fds[i]);
+    }
+    server->n_fds = 0;
+
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_ZERO(&except_fds);
+    if (MHD_get_fdset(g_daemon, &read_fds, &write_fds, &except_fds, &max_fd) == MHD_YES)
+    {
+        for (fd = 0; fd <= max_fd && fd < FD_SETSIZE; fd++)
+        {
+            gushort events = 0;
+
+            if (FD_ISSET(fd, &read_fds))
+            {
+                events |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+            }
+            if (FD_ISSET(fd, &write_fds))
+            {
+                events |= G_IO_OUT | G_IO_ERR;
+            }
+            if (FD_ISSET(fd, &except_fds))
+            {
+                events |= G_IO_PRI;
+            }
+            if (events)
+            {
+                GPollFD *poll_fd = &server->fds[server->n_fds++];
+                poll_fd->fd      = fd;
+                poll_fd->events  = events;
+                poll_fd->revents = 0;
+                g_source_add_poll(source, poll_fd);
+            }
+        }
+    }
+
+    // no timeout pending: sleep until a socket is ready
+    *timeout = -1;
+    if (MHD_get_timeout(g_daemon, &ms) == MHD_YES)
+    {
+        *timeout = (gint) MIN(ms, (unsigned long long) G_MAXINT);
+    }
+    return (*timeout == 0);
+}
+
+
+static gboolean server_source_check(GSource *source)
+{
+    ServerSource       *server = (ServerSource *) source;
+    unsigned long long ms      = 0;
+    guint              i;
+
+    for (i = 0; i < server->n_fds; i++)
+    {
+        if (server->fds[i].revents)
+        {
+            return TRUE;
+        }
+    }
+    return (MHD_get_timeout(g_daemon, &ms) == MHD_YES && ms == 0);
+}
+
+
+// Let the daemon handle the sockets found ready, without selecting again
+static gboolean server_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    ServerSource *server = (ServerSource *) source;
+    fd_set       read_fds;
+    fd_set       write_fds;
+    fd_set       except_fds;
+    guint        i;
+
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_ZERO(&except_fds);
+    for (i = 0; i < server->n_fds; i++)
+    {
+        GPollFD *poll_fd = &server->fds[i];
+
+        // a hang-up or error shows as readiness for what was asked
+        if ((poll_fd->events & G_IO_IN) && (poll_fd->revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)))
+        {
+            FD_SET(poll_fd->fd, &read_fds);
+        }
+        if ((poll_fd->events & G_IO_OUT) && (poll_fd->revents & (G_IO_OUT | G_IO_ERR)))
+        {
+            FD_SET(poll_fd->fd, &write_fds);
+        }
+        if (poll_fd->revents & G_IO_PRI)
+        {
+            FD_SET(poll_fd->fd, &except_fds);
+        }
+    }
+
+    MHD_run_from_select(g_daemon, &read_fds, &write_fds, &except_fds);
+    return TRUE;
+}
+
+
+static void server_source_finalize(GSource *source)
+{
+    ServerSource *server = (ServerSource *) source;
+
+    g_free(server->fds);
+    server->fds   = NULL;
+    server->n_fds = 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * File Name: spill.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// local include files, between " "
+#include "log.h"
+#include "spill.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+#define SPILL_PREFIX    "entry-"
+
+typedef struct
+{
+    gchar   *key;           // archive + '\n' + version + '\n' + entry name
+    gchar   *path;          // spill file
+    gsize   size;
+    GList   *lru_link;      // link in g_lru
+} SpillEntry;
+
+struct _SpillFile
+{
+    gchar   *key;
+    gchar   *path;
+    gsize   size;
+    gint    fd;             // opened for writing
+};
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static GStaticMutex g_spill_mutex = G_STATIC_MUTEX_INIT;
+static gchar        *g_dir        = NULL;   // of this process, in the spill directory
+static GHashTable   *g_entries    = NULL;   // key -> SpillEntry
+static GQueue       *g_lru        = NULL;   // head is most recently used
+static guint        g_sequence    = 0;      // for unique file names
+static SpillStats   g_stats;
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static gchar *make_key          (const gchar *archive, const gchar *version, const gchar *name);
+static gboolean key_has_archive (const gchar *key, const gchar *archive, const gchar *version);
+static void   remove_entry      (SpillEntry *entry);
+static void   evict_until       (gsize needed);
+static void   remove_stale_files(const gchar *dir);
+static void   remove_stale_dirs (const gchar *parent);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gboolean spill_init(const gchar *dir, gsize limit)
+{
+    gchar *own = NULL;
+
+    LOGPRINTF("dir [%s] limit [%lu]", dir, (gulong) limit);
+
+    g_return_val_if_fail(dir, FALSE);
+
+    if (limit == 0)
+    {
+        return FALSE;
+    }
+
+    // the directory may be shared by several instances, each spilling
+    // into a directory named by its pid
+    own = g_strdup_printf("%s/%d", dir, (gint) getpid());
+    if (g_mkdir_with_parents(own, 0700) != 0)
+    {
+        ERRNOPRINTF("cannot create spill directory [%s]", own);
+        g_free(own);
+        return FALSE;
+    }
+    remove_stale_dirs(dir);
+    remove_stale_files(own);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    g_dir     = own;
+    g_entries = g_hash_table_new(g_str_hash, g_str_equal);
+    g_lru     = g_queue_new();
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.limit = limit;
+    g_static_mutex_unlock(&g_spill_mutex);
+
+    return TRUE;
+}
+
+
+void spill_destroy(void)
+{
+    LOGPRINTF("entry");
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_entries)
+    {
+        while (!g_queue_is_empty(g_lru))
+        {
+            remove_entry(g_queue_peek_head(g_lru));
+        }
+        g_hash_table_destroy(g_entries);
+        g_queue_free(g_lru);
+        g_entries = NULL;
+        g_lru     = NULL;
+
+        rmdir(g_dir);
+        g_free(g_dir);
+        g_dir = NULL;
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+}
+
+
+gint spill_open(const gchar *archive, const gchar *version, const gchar *name, gsize *size)
+{
+    SpillEntry *entry = NULL;
+    gchar      *key   = NULL;
+    gint       fd     = -1;
+
+    g_return_val_if_fail(archive && version && name && size, -1);
+
+    key = make_key(archive, version, name);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_entries)
+    {
+        entry = g_hash_table_lookup(g_entries, key);
+        if (entry)
+        {
+            fd = open(entry->path, O_RDONLY);
+        }
+
+        if (fd >= 0)
+        {
+            g_queue_unlink(g_lru, entry->lru_link);
+            g_queue_push_head_link(g_lru, entry->lru_link);
+            *size = entry->size;
+            g_stats.hits++;
+        }
+        else
+        {
+            if (entry)
+            {
+                // removed behind our back, forget about it
+                ERRNOPRINTF("cannot open [%s]", entry->path);
+                remove_entry(entry);
+            }
+            g_stats.misses++;
+        }
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+
+    g_free(key);
+    return fd;
+}
+
+
+SpillFile *spill_begin(const gchar *archive, const gchar *version, const gchar *name, gsize size)
+{
+    SpillFile *file = NULL;
+
+    g_return_val_if_fail(archive && version && name, NULL);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_entries && size <= g_stats.limit)
+    {
+        evict_until(g_stats.limit - size);
+        if (g_stats.bytes_used + size <= g_stats.limit)
+        {
+            file        = g_new0(SpillFile, 1);
+            file->key   = make_key(archive, version, name);
+            file->path  = g_strdup_printf("%s/" SPILL_PREFIX "%u", g_dir, ++g_sequence);
+            file->size  = size;
+
+            // reserve room while the file is being written
+            g_stats.bytes_used += size;
+        }
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    file->fd = open(file->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (file->fd < 0)
+    {
+        ERRNOPRINTF("cannot create [%s]", file->path);
+        spill_abort(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+
+gint spill_file_get_fd(SpillFile *file)
+{
+    return file->fd;
+}
+
+
+gint spill_commit(SpillFile *file)
+{
+    SpillEntry *entry = NULL;
+    SpillEntry *old   = NULL;
+    gint       fd     = -1;
+
+    g_return_val_if_fail(file, -1);
+
+    if (close(file->fd) != 0)
+    {
+        ERRNOPRINTF("cannot write [%s]", file->path);
+        file->fd = -1;
+        spill_abort(file);
+        return -1;
+    }
+    file->fd = -1;
+
+    fd = open(file->path, O_RDONLY);
+    if (fd < 0)
+    {
+        ERRNOPRINTF("cannot open [%s]", file->path);
+        spill_abort(file);
+        return -1;
+    }
+
+    entry       = g_new0(SpillEntry, 1);
+    entry->key  = file->key;
+    entry->path = file->path;
+    entry->size = file->size;
+    g_free(file);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_entries)
+    {
+        old = g_hash_table_lookup(g_entries, entry->key);
+        if (old)
+        {
+            remove_entry(old);
+        }
+        g_queue_push_head(g_lru, entry);
+        entry->lru_link = g_queue_peek_head_link(g_lru);
+        g_hash_table_insert(g_entries, entry->key, entry);
+        g_stats.files++;
+        g_stats.stores++;
+        entry = NULL;
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+
+    if (entry)
+    {
+        // spill tier destroyed meanwhile
+        unlink(entry->path);
+        g_free(entry->key);
+        g_free(entry->path);
+        g_free(entry);
+    }
+
+    return fd;
+}
+
+
+void spill_abort(SpillFile *file)
+{
+    g_return_if_fail(file);
+
+    if (file->fd >= 0)
+    {
+        close(file->fd);
+    }
+    unlink(file->path);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_entries)
+    {
+        g_stats.bytes_used -= file->size;
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+
+    g_free(file->key);
+    g_free(file->path);
+    g_free(file);
+}
+
+
+void spill_invalidate_archive(const gchar *archive, const gchar *version)
+{
+    GList *link = NULL;
+    GList *next = NULL;
+
+    g_return_if_fail(archive);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    if (g_lru)
+    {
+        for (link = g_queue_peek_head_link(g_lru); link; link = next)
+        {
+            SpillEntry *entry = link->data;
+            next = link->next;
+            if (key_has_archive(entry->key, archive, version))
+            {
+                remove_entry(entry);
+            }
+        }
+    }
+    g_static_mutex_unlock(&g_spill_mutex);
+}
+
+
+void spill_get_stats(SpillStats *stats)
+{
+    g_return_if_fail(stats);
+
+    g_static_mutex_lock(&g_spill_mutex);
+    *stats = g_stats;
+    g_static_mutex_unlock(&g_spill_mutex);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static gchar *make_key(const gchar *archive, const gchar *version, const gchar *name)
+{
+    return g_strconcat(archive, "\n", version, "\n", name, NULL);
+}
+
+
+// Any version when version is NULL
+static gboolean key_has_archive(const gchar *key, const gchar *archive, const gchar *version)
+{
+    gsize len = strlen(archive);
+
+    if (strncmp(key, archive, len) != 0 || key[len] != '\n')
+    {
+        return FALSE;
+    }
+    if (version == NULL)
+    {
+        return TRUE;
+    }
+
+    key += len + 1;
+    len  = strlen(version);
+    return (strncmp(key, version, len) == 0 && key[len] == '\n');
+}
+
+
+// call with g_spill_mutex held
+static void remove_entry(SpillEntry *entry)
+{
+    g_hash_table_remove(g_entries, entry->key);
+    g_queue_delete_link(g_lru, entry->lru_link);
+
+    // open descriptors keep the data alive until they are closed
+    unlink(entry->path);
+
+    g_stats.bytes_used -= entry->size;
+    g_stats.files--;
+
+    g_free(entry->key);
+    g_free(entry->path);
+    g_free(entry);
+}
+
+
+// call with g_spill_mutex held
+static void evict_until(gsize needed)
+{
+    while (g_stats.bytes_used > needed && !g_queue_is_empty(g_lru))
+    {
+        SpillEntry *entry = g_queue_peek_tail_link(g_lru)->data;
+        LOGPRINTF("evicting [%s]", entry->path);
+        remove_entry(entry);
+        g_stats.evictions++;
+    }
+}
+
+
+// Remove the directories of instances that are no longer running
+static void remove_stale_dirs(const gchar *parent)
+{
+    GDir        *handle = g_dir_open(parent, 0, NULL);
+    const gchar *name   = NULL;
+    gchar       *end    = NULL;
+    glong       pid;
+
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    while ((name = g_dir_read_name(handle)) != NULL)
+    {
+        pid = strtol(name, &end, 10);
+        if (pid > 0 && *end == '\0' && pid != getpid()
+            && kill((pid_t) pid, 0) != 0 && errno == ESRCH)
+        {
+            gchar *path = g_build_filename(parent, name, NULL);
+            remove_stale_files(path);
+            rmdir(path);
+            g_free(path);
+        }
+    }
+    g_dir_close(handle);
+}
+
+
+static void remove_stale_files(const gchar *dir)
+{
+    GDir        *handle = g_dir_open(dir, 0, NULL);
+    const gchar *name   = NULL;
+
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    while ((name = g_dir_read_name(handle)) != NULL)
+    {
+        if (g_str_has_prefix(name, SPILL_PREFIX))
+        {
+            gchar *path = g_build_filename(dir, name, NULL);
+            unlink(path);
+            g_free(path);
+        }
+    }
+    g_dir_close(handle);
+}
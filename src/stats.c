@@ -0,0 +1,163 @@
+/*
+ * File Name: stats.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+
+// local include files, between " "
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+// 32-bit atomics only; the total is kept as seconds and a remainder
+typedef struct
+{
+    volatile gint   count;
+    volatile gint   seconds;        // of the total
+    volatile gint   usec;           // of the total, always below a second
+    volatile gint   max_us;
+    volatile gint   buckets[STATS_BUCKETS];
+} Phase;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+static const gchar *phase_names[STATS_PHASES] =
+{
+    "open",
+    "index",
+    "lookup",
+    "queue",
+    "inflate",
+    "request"
+};
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static Phase        g_phases[STATS_PHASES];
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gint64 stats_get_time(void)
+{
+    GTimeVal now;
+
+    g_get_current_time(&now);
+    return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+
+void stats_add(StatsPhase phase, gint64 start)
+{
+    Phase    *stats  = NULL;
+    gint64   elapsed = stats_get_time() - start;
+    gint     usec;
+    gint     rest;
+    gint     old;
+    gint     total;
+    gboolean carry;
+    guint    bucket  = 0;
+
+    g_return_if_fail((guint) phase < STATS_PHASES);
+
+    // the clock may have been set back meanwhile
+    usec  = (gint) CLAMP(elapsed, 0, G_MAXINT);
+    stats = &g_phases[phase];
+
+    while (bucket < STATS_BUCKETS - 1 && (usec >> bucket) != 0)
+    {
+        bucket++;
+    }
+    g_atomic_int_inc(&stats->buckets[bucket]);
+    g_atomic_int_inc(&stats->count);
+
+    g_atomic_int_add(&stats->seconds, usec / G_USEC_PER_SEC);
+    rest = usec % G_USEC_PER_SEC;
+    do
+    {
+        old   = g_atomic_int_get(&stats->usec);
+        total = old + rest;
+        carry = (total >= G_USEC_PER_SEC);
+        if (carry)
+        {
+            total -= G_USEC_PER_SEC;
+        }
+    } while (!g_atomic_int_compare_and_exchange(&stats->usec, old, total));
+    if (carry)
+    {
+        g_atomic_int_inc(&stats->seconds);
+    }
+
+    do
+    {
+        old = g_atomic_int_get(&stats->max_us);
+    } while (usec > old && !g_atomic_int_compare_and_exchange(&stats->max_us, old, usec));
+}
+
+
+void stats_get_phase(StatsPhase phase, PhaseStats *stats)
+{
+    Phase *from = NULL;
+    guint i;
+
+    g_return_if_fail((guint) phase < STATS_PHASES);
+    g_return_if_fail(stats);
+
+    from            = &g_phases[phase];
+    stats->count    = (guint) g_atomic_int_get(&from->count);
+    stats->total_us = (guint64) g_atomic_int_get(&from->seconds) * G_USEC_PER_SEC
+                      + (guint64) g_atomic_int_get(&from->usec);
+    stats->max_us   = (guint) g_atomic_int_get(&from->max_us);
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        stats->buckets[i] = (guint) g_atomic_int_get(&from->buckets[i]);
+    }
+}
+
+
+const gchar *stats_phase_name(StatsPhase phase)
+{
+    g_return_val_if_fail((guint) phase < STATS_PHASES, "unknown");
+
+    return phase_names[phase];
+}
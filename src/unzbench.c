@@ -0,0 +1,304 @@
+/*
+ * File Name: unzbench.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+/*
+ * Decode throughput per compression method.
+ *
+ * Decompresses every entry of the given archives a number of times through
+ * unzip.c, exactly as the HTTP server does, and reports the throughput of
+ * each compression method found. Not installed; build with 'make unzbench'.
+ *
+ *   unzbench [--runs N] [--chunk BYTES | --fully] archive...
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// local include files, between " "
+#include "unzip.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct
+{
+    guint   method;
+    guint   entries;
+    guint64 compressed;     // bytes read, over all runs
+    guint64 uncompressed;   // bytes produced, over all runs
+    gdouble seconds;
+    guint   errors;
+} MethodStats;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#ifndef UNZ_MAXFILENAMEINZIP
+#define UNZ_MAXFILENAMEINZIP (256)
+#endif
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static gint    g_runs  = 5;
+static gint    g_chunk = 0;         // 0: read each entry with a single call
+static gboolean g_fully = FALSE;    // read with unzReadCurrentFileFully()
+static GArray  *g_stats = NULL;     // MethodStats
+
+static GOptionEntry entries[] =
+{
+    { "runs",  'n', 0, G_OPTION_ARG_INT, &g_runs,  "Decode every entry N times (default 5)", "N" },
+    { "chunk", 'c', 0, G_OPTION_ARG_INT, &g_chunk, "Read in chunks of BYTES instead of whole entries", "BYTES" },
+    { "fully", 'f', 0, G_OPTION_ARG_NONE, &g_fully, "Read whole entries with unzReadCurrentFileFully", NULL },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static MethodStats *get_method_stats(guint method);
+static const gchar *method_name     (guint method);
+static gboolean     bench_archive   (const gchar *archive);
+static gboolean     decode_entry    (unzFile zip, guchar *buf, gsize size);
+static void         print_stats     (void);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = NULL;
+    GError         *error   = NULL;
+    int            ret      = 0;
+    int            i;
+
+    context = g_option_context_new("ARCHIVE... - measure decode throughput per compression method");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (argc < 2 || g_runs < 1 || g_chunk < 0 || (g_chunk && g_fully))
+    {
+        fprintf(stderr, "usage: %s [--runs N] [--chunk BYTES | --fully] ARCHIVE...\n", argv[0]);
+        return 1;
+    }
+
+    g_stats = g_array_new(FALSE, TRUE, sizeof(MethodStats));
+    for (i = 1; i < argc; i++)
+    {
+        if (!bench_archive(argv[i]))
+        {
+            ret = 1;
+        }
+    }
+    print_stats();
+    g_array_free(g_stats, TRUE);
+
+    return ret;
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static MethodStats *get_method_stats(guint method)
+{
+    MethodStats stats;
+    guint       i;
+
+    for (i = 0; i < g_stats->len; i++)
+    {
+        if (g_array_index(g_stats, MethodStats, i).method == method)
+        {
+            return &g_array_index(g_stats, MethodStats, i);
+        }
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.method = method;
+    g_array_append_val(g_stats, stats);
+    return &g_array_index(g_stats, MethodStats, g_stats->len - 1);
+}
+
+
+static const gchar *method_name(guint method)
+{
+    switch (method)
+    {
+        case 0:         return "stored";
+        case Z_DEFLATED:return "deflate";
+        case Z_BZIP2ED: return "bzip2";
+        case Z_LZMAED:  return "lzma";
+        case Z_ZSTDED:  return "zstd";
+        default:        return "other";
+    }
+}
+
+
+static gboolean bench_archive(const gchar *archive)
+{
+    unzFile         zip  = unzOpen64(archive);
+    unz_file_info64 file_info;
+    char            name[UNZ_MAXFILENAMEINZIP + 1];
+    guchar          *buf = NULL;
+    gsize           buf_size = 0;
+    GTimer          *timer = NULL;
+    int             err;
+    gint            run;
+
+    if (zip == NULL)
+    {
+        fprintf(stderr, "cannot open [%s]\n", archive);
+        return FALSE;
+    }
+
+    timer = g_timer_new();
+    for (err = unzGoToFirstFile(zip); err == UNZ_OK; err = unzGoToNextFile(zip))
+    {
+        MethodStats *stats = NULL;
+        gboolean    ok     = TRUE;
+
+        unzGetCurrentFileInfo64(zip, &file_info, name, sizeof(name), NULL, 0, NULL, 0);
+        if (file_info.uncompressed_size == 0)
+        {
+            continue;   // directory or empty file
+        }
+
+        if (buf_size < file_info.uncompressed_size)
+        {
+            buf_size = file_info.uncompressed_size;
+            buf      = g_realloc(buf, buf_size);
+        }
+
+        stats = get_method_stats(file_info.compression_method);
+        stats->entries++;
+
+        g_timer_start(timer);
+        for (run = 0; run < g_runs && ok; run++)
+        {
+            ok = decode_entry(zip, buf, file_info.uncompressed_size);
+        }
+        g_timer_stop(timer);
+
+        if (ok)
+        {
+            stats->seconds      += g_timer_elapsed(timer, NULL);
+            stats->compressed   += file_info.compressed_size * g_runs;
+            stats->uncompressed += file_info.uncompressed_size * g_runs;
+        }
+        else
+        {
+            fprintf(stderr, "cannot decode [%s] in [%s]\n", name, archive);
+            stats->errors++;
+        }
+    }
+
+    g_timer_destroy(timer);
+    g_free(buf);
+    unzClose(zip);
+
+    return TRUE;
+}
+
+
+static gboolean decode_entry(unzFile zip, guchar *buf, gsize size)
+{
+    gsize done = 0;
+    int   len  = 0;
+
+    if (unzOpenCurrentFile(zip) != UNZ_OK)
+    {
+        return FALSE;
+    }
+
+    if (g_fully)
+    {
+        len = unzReadCurrentFileFully(zip, buf, size);
+        return (unzCloseCurrentFile(zip) == UNZ_OK && len == UNZ_OK);
+    }
+
+    while (done < size)
+    {
+        len = unzReadCurrentFile(zip, buf + done, g_chunk ? (unsigned) MIN((gsize) g_chunk, size - done)
+                                                          : (unsigned) (size - done));
+        if (len <= 0)
+        {
+            break;
+        }
+        done += len;
+    }
+
+    return (unzCloseCurrentFile(zip) == UNZ_OK && done == size);
+}
+
+
+static void print_stats(void)
+{
+    guint i;
+
+    printf("%-8s %8s %8s %12s %12s %7s\n",
+           "method", "entries", "ratio", "MB/s out", "MB/s in", "errors");
+
+    for (i = 0; i < g_stats->len; i++)
+    {
+        const MethodStats *stats = &g_array_index(g_stats, MethodStats, i);
+        gdouble           secs   = (stats->seconds > 0) ? stats->seconds : 1e-9;
+
+        printf("%-8s %8u %8.3f %12.1f %12.1f %7u\n",
+               method_name(stats->method),
+               stats->entries,
+               stats->uncompressed ? (gdouble) stats->compressed / stats->uncompressed : 0.0,
+               stats->uncompressed / secs / 1e6,
+               stats->compressed / secs / 1e6,
+               stats->errors);
+    }
+}
@@ -59,14 +59,31 @@
 
   Jan-2010 - back to unzip and minizip 1.0 name scheme, with compatibility layer
 
+  zipbrowser - Whole-entry deflate decoding with libdeflate (HAVE_LIBDEFLATE)
+  zipbrowser - LZMA (method 14, HAVE_LZMA) and Zstandard (method 93, HAVE_ZSTD)
+               entry decoding
+  zipbrowser - Keep the read state, read buffer and inflate state of the last
+               closed file for the next unzOpenCurrentFile (inflateReset
+               instead of inflateInit2/inflateEnd per entry)
+  zipbrowser - Per archive CRC policy (unzSetCrcPolicy) and CRC statistics
+  zipbrowser - WinZip AES (AE-1/AE-2, method 99) decryption with nettle
+               (HAVE_NETTLE); traditional PKWARE encryption stays disabled
+  zipbrowser - unzReadCurrentFileFully, decoding a whole entry straight into
+               the caller's buffer
+
   Copyright (C) 1998 - 2010 Gilles Vollant, Even Rouault, Mathias Svensson
 
 */
 
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef NOUNCRYPT
         #define NOUNCRYPT
@@ -75,6 +92,25 @@
 #include "zlib.h"
 #include "unzip.h"
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_NETTLE
+#include <nettle/aes.h>
+#include <nettle/hmac.h>
+#include <nettle/memxor.h>
+#include <nettle/pbkdf2.h>
+#endif
+
 #ifdef STDC
 #  include <stddef.h>
 #  include <string.h>
@@ -108,6 +144,12 @@
 #define UNZ_MAXFILENAMEINZIP (256)
 #endif
 
+/* largest compressed entry that is read into memory at once and decoded
+   in a single call, instead of being inflated in UNZ_BUFSIZE steps */
+#ifndef UNZ_ONESHOT_MAXSIZE
+#define UNZ_ONESHOT_MAXSIZE (8*1024*1024)
+#endif
+
 #ifndef ALLOC
 # define ALLOC(size) (malloc(size))
 #endif
@@ -126,8 +168,36 @@ const char unz_copyright[] =
 typedef struct unz_file_info64_internal_s
 {
     ZPOS64_T offset_curfile;/* relative offset of local header 8 bytes */
+    uLong aes_version;      /* WinZip AES extra field (0x9901): 1 = AE-1, 2 = AE-2, 0 = none */
+    uLong aes_strength;     /* 1 = AES-128, 2 = AES-192, 3 = AES-256 */
+    uLong aes_method;       /* compression method of the decrypted data */
 } unz_file_info64_internal;
 
+#ifdef HAVE_NETTLE
+#define UNZ_AES_PWVERIFY_SIZE   (2)
+#define UNZ_AES_AUTHCODE_SIZE   (10)
+#define UNZ_AES_ITERATIONS      (1000)
+#define UNZ_AES_BATCH           (64)    /* key stream blocks generated per cipher call */
+
+/* WinZip AES decryption state: AES in CTR mode with a little endian block
+   counter starting at 1, and HMAC-SHA1 over the encrypted data */
+typedef struct
+{
+    union
+    {
+        struct aes128_ctx a128;
+        struct aes192_ctx a192;
+        struct aes256_ctx a256;
+    } cipher;
+    nettle_cipher_func* encrypt;
+    struct hmac_sha1_ctx hmac;
+    int version;
+    unsigned char counter[AES_BLOCK_SIZE];
+    unsigned char keystream[UNZ_AES_BATCH*AES_BLOCK_SIZE];
+    uInt keystream_pos;     /* bytes of keystream already used */
+} unz64_aes_s;
+#endif
+
 
 /* file_in_zip_read_info_s contain internal information about a file in zipfile,
     when reading and decompress it */
@@ -140,6 +210,18 @@ typedef struct
     bz_stream bstream;          /* bzLib stream structure for bziped */
 #endif
 
+#ifdef HAVE_LZMA
+    lzma_stream lstream;        /* liblzma stream structure for lzma */
+#endif
+
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zstream;      /* zstd stream structure for zstd */
+#endif
+
+#ifdef HAVE_NETTLE
+    unz64_aes_s* aes;           /* decryption state of an AES encrypted file */
+#endif
+
     ZPOS64_T pos_in_zipfile;       /* position in byte on the zipfile, for fseek*/
     uLong stream_initialised;   /* flag set if stream structure is initialised*/
 
@@ -157,6 +239,7 @@ typedef struct
     uLong compression_method;   /* compression method (0==store) */
     ZPOS64_T byte_before_the_zipfile;/* byte before the zipfile, (>0 for sfx)*/
     int   raw;
+    int   inflate_ready;        /* stream holds an inflate state, reset before reuse */
 } file_in_zip64_read_info_s;
 
 
@@ -186,6 +269,15 @@ typedef struct
 
     int isZip64;
 
+    file_in_zip64_read_info_s* pfile_in_zip_spare; /* kept by unzCloseCurrentFile for reuse */
+
+    int crc_policy;                 /* UNZ_CRC_INLINE or UNZ_CRC_SKIP */
+    unz_crc_stats crc_stats;
+
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_decompressor* deflate_decompressor; /* created on first use */
+#endif
+
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
@@ -749,7 +841,13 @@ local unzFile unzOpenInternal (const void *path,
                             (us.offset_central_dir+us.size_central_dir);
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
+    us.pfile_in_zip_spare = NULL;
+    us.crc_policy = UNZ_CRC_INLINE;
+    memset(&us.crc_stats, 0, sizeof(us.crc_stats));
     us.encrypted = 0;
+#ifdef HAVE_LIBDEFLATE
+    us.deflate_decompressor = NULL;
+#endif
 
 
     s=(unz64_s*)ALLOC(sizeof(unz64_s));
@@ -800,6 +898,69 @@ extern unzFile ZEXPORT unzOpen64 (const void *path)
     return unzOpenInternal(path, NULL, 1);
 }
 
+/*
+  Read state of an open file: the one kept by the last unzCloseCurrentFile
+  when there is one, a new one otherwise. read_buffer is always allocated;
+  the stream is ready for inflateReset when inflate_ready is set.
+*/
+local file_in_zip64_read_info_s* unz64local_AllocReadInfo OF((unz64_s* s));
+local file_in_zip64_read_info_s* unz64local_AllocReadInfo (unz64_s* s)
+{
+    file_in_zip64_read_info_s* pfile_in_zip_read_info = s->pfile_in_zip_spare;
+
+    if (pfile_in_zip_read_info!=NULL)
+    {
+        s->pfile_in_zip_spare = NULL;
+        return pfile_in_zip_read_info;
+    }
+
+    pfile_in_zip_read_info = (file_in_zip64_read_info_s*)ALLOC(sizeof(file_in_zip64_read_info_s));
+    if (pfile_in_zip_read_info==NULL)
+        return NULL;
+
+    pfile_in_zip_read_info->read_buffer=(char*)ALLOC(UNZ_BUFSIZE);
+    if (pfile_in_zip_read_info->read_buffer==NULL)
+    {
+        TRYFREE(pfile_in_zip_read_info);
+        return NULL;
+    }
+    pfile_in_zip_read_info->inflate_ready=0;
+#ifdef HAVE_NETTLE
+    pfile_in_zip_read_info->aes=NULL;
+#endif
+
+    return pfile_in_zip_read_info;
+}
+
+local void unz64local_FreeReadInfo OF((file_in_zip64_read_info_s* pfile_in_zip_read_info));
+local void unz64local_FreeReadInfo (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    if (pfile_in_zip_read_info->inflate_ready)
+        inflateEnd(&pfile_in_zip_read_info->stream);
+    TRYFREE(pfile_in_zip_read_info->read_buffer);
+    TRYFREE(pfile_in_zip_read_info);
+}
+
+/* Give back a read state, keeping it for the next file opened */
+local void unz64local_ReleaseReadInfo OF((unz64_s* s, file_in_zip64_read_info_s* pfile_in_zip_read_info));
+local void unz64local_ReleaseReadInfo (unz64_s* s, file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    pfile_in_zip_read_info->stream_initialised=0;
+#ifdef HAVE_NETTLE
+    if (pfile_in_zip_read_info->aes!=NULL)
+    {
+        /* do not leave key material behind in freed memory */
+        memset(pfile_in_zip_read_info->aes, 0, sizeof(unz64_aes_s));
+        TRYFREE(pfile_in_zip_read_info->aes);
+        pfile_in_zip_read_info->aes=NULL;
+    }
+#endif
+    if (s->pfile_in_zip_spare==NULL)
+        s->pfile_in_zip_spare = pfile_in_zip_read_info;
+    else
+        unz64local_FreeReadInfo(pfile_in_zip_read_info);
+}
+
 /*
   Close a ZipFile opened with unzipOpen.
   If there is files inside the .Zip opened with unzipOpenCurrentFile (see later),
@@ -815,6 +976,14 @@ extern int ZEXPORT unzClose (unzFile file)
     if (s->pfile_in_zip_read!=NULL)
         unzCloseCurrentFile(file);
 
+    if (s->pfile_in_zip_spare!=NULL)
+        unz64local_FreeReadInfo(s->pfile_in_zip_spare);
+
+#ifdef HAVE_LIBDEFLATE
+    if (s->deflate_decompressor!=NULL)
+        libdeflate_free_decompressor(s->deflate_decompressor);
+#endif
+
     ZCLOSE64(s->z_filefunc, s->filestream);
     TRYFREE(s);
     return UNZ_OK;
@@ -1009,6 +1178,10 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
         lSeek += file_info.size_file_extra;
 
 
+    file_info_internal.aes_version = 0;
+    file_info_internal.aes_strength = 0;
+    file_info_internal.aes_method = 0;
+
     if ((err==UNZ_OK) && (file_info.size_file_extra != 0))
     {
                                 uLong acc = 0;
@@ -1067,6 +1240,27 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
                                                                 }
 
             }
+            /* WinZip AES extra field */
+            else if ((headerId == 0x9901) && (dataSize == 7))
+            {
+                uLong uVendorId;
+                int iStrength;
+
+                if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info_internal.aes_version) != UNZ_OK)
+                    err=UNZ_ERRNO;
+                if (unz64local_getShort(&s->z_filefunc, s->filestream,&uVendorId) != UNZ_OK)
+                    err=UNZ_ERRNO;
+                if (unz64local_getByte(&s->z_filefunc, s->filestream,&iStrength) != UNZ_OK)
+                    err=UNZ_ERRNO;
+                if (unz64local_getShort(&s->z_filefunc, s->filestream,&file_info_internal.aes_method) != UNZ_OK)
+                    err=UNZ_ERRNO;
+                file_info_internal.aes_strength = (uLong)iStrength;
+
+                if ((uVendorId != 0x4541) /* "AE" */ ||
+                    (file_info_internal.aes_version < 1) || (file_info_internal.aes_version > 2) ||
+                    (file_info_internal.aes_strength < 1) || (file_info_internal.aes_strength > 3))
+                    file_info_internal.aes_version = 0;
+            }
             else
             {
                 if (ZSEEK64(s->z_filefunc, s->filestream,dataSize,ZLIB_FILEFUNC_SEEK_CUR)!=0)
@@ -1426,6 +1620,15 @@ local int unz64local_CheckCurrentFileCoherencyHeader (unz64_s* s, uInt* piSizeVa
 /* #ifdef HAVE_BZIP2 */
                          (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
 /* #endif */
+#ifdef HAVE_LZMA
+                         (s->cur_file_info.compression_method!=Z_LZMAED) &&
+#endif
+#ifdef HAVE_ZSTD
+                         (s->cur_file_info.compression_method!=Z_ZSTDED) &&
+#endif
+#ifdef HAVE_NETTLE
+                         (s->cur_file_info.compression_method!=Z_AESED) &&
+#endif
                          (s->cur_file_info.compression_method!=Z_DEFLATED))
         err=UNZ_BADZIPFILE;
 
@@ -1465,6 +1668,232 @@ local int unz64local_CheckCurrentFileCoherencyHeader (unz64_s* s, uInt* piSizeVa
     return err;
 }
 
+#ifdef HAVE_NETTLE
+/*
+  Generate the next UNZ_AES_BATCH blocks of CTR key stream. The counter
+  blocks are laid out first and then encrypted with a single cipher call,
+  which lets nettle use AES-NI or the ARMv8 crypto extensions on the whole
+  batch when it detects them at run time.
+*/
+local void unz64local_AesRefill OF((unz64_aes_s* aes));
+local void unz64local_AesRefill (unz64_aes_s* aes)
+{
+    uInt i, j;
+
+    for (i=0;i<UNZ_AES_BATCH;i++)
+    {
+        memcpy(aes->keystream + i*AES_BLOCK_SIZE, aes->counter, AES_BLOCK_SIZE);
+        for (j=0;(j<AES_BLOCK_SIZE) && (++aes->counter[j]==0);j++)
+            ;
+    }
+    aes->encrypt(&aes->cipher, sizeof(aes->keystream), aes->keystream, aes->keystream);
+    aes->keystream_pos = 0;
+}
+
+/* Authenticate and decrypt len bytes of the file data, in place */
+local void unz64local_AesDecrypt OF((unz64_aes_s* aes, unsigned char* buf, uInt len));
+local void unz64local_AesDecrypt (unz64_aes_s* aes, unsigned char* buf, uInt len)
+{
+    hmac_sha1_update(&aes->hmac, len, buf);
+
+    while (len>0)
+    {
+        uInt uAvail;
+
+        if (aes->keystream_pos == sizeof(aes->keystream))
+            unz64local_AesRefill(aes);
+
+        uAvail = (uInt)sizeof(aes->keystream) - aes->keystream_pos;
+        if (uAvail>len)
+            uAvail = len;
+        memxor(buf, aes->keystream + aes->keystream_pos, uAvail);
+
+        aes->keystream_pos += uAvail;
+        buf += uAvail;
+        len -= uAvail;
+    }
+}
+
+/*
+  The data of a WinZip AES entry is: salt (8, 12 or 16 bytes), 2 bytes
+  password verification value, the encrypted data, and 10 bytes of
+  HMAC-SHA1 authentication code. Derive the keys from the password and
+  the salt, check the verification value and leave pos_in_zipfile and
+  rest_read_compressed on the encrypted data.
+*/
+local int unz64local_InitAes OF((unz64_s* s, file_in_zip64_read_info_s* pfile_in_zip_read_info,
+                                 const char* password));
+local int unz64local_InitAes (unz64_s* s, file_in_zip64_read_info_s* pfile_in_zip_read_info,
+                              const char* password)
+{
+    unsigned char header[16+UNZ_AES_PWVERIFY_SIZE];
+    unsigned char derived[2*32+UNZ_AES_PWVERIFY_SIZE];
+    unz64_aes_s* aes;
+    uInt uKeySize = 8 + 8*(uInt)s->cur_file_info_internal.aes_strength;
+    uInt uSaltSize = uKeySize/2;
+
+    if (password==NULL)
+        return UNZ_BADPASSWORD;
+
+    if (pfile_in_zip_read_info->rest_read_compressed <
+            uSaltSize+UNZ_AES_PWVERIFY_SIZE+UNZ_AES_AUTHCODE_SIZE)
+        return UNZ_BADZIPFILE;
+
+    if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                pfile_in_zip_read_info->pos_in_zipfile +
+                   pfile_in_zip_read_info->byte_before_the_zipfile,
+                ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return UNZ_ERRNO;
+    if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                header, uSaltSize+UNZ_AES_PWVERIFY_SIZE)!=uSaltSize+UNZ_AES_PWVERIFY_SIZE)
+        return UNZ_ERRNO;
+
+    /* AES key, HMAC key, password verification value */
+    pbkdf2_hmac_sha1(strlen(password), (const uint8_t*)password, UNZ_AES_ITERATIONS,
+                     uSaltSize, header, 2*uKeySize+UNZ_AES_PWVERIFY_SIZE, derived);
+
+    if (memcmp(derived + 2*uKeySize, header + uSaltSize, UNZ_AES_PWVERIFY_SIZE)!=0)
+    {
+        memset(derived, 0, sizeof(derived));
+        return UNZ_BADPASSWORD;
+    }
+
+    aes = (unz64_aes_s*)ALLOC(sizeof(unz64_aes_s));
+    if (aes==NULL)
+    {
+        memset(derived, 0, sizeof(derived));
+        return UNZ_INTERNALERROR;
+    }
+
+    switch (s->cur_file_info_internal.aes_strength)
+    {
+      case 1 :
+        aes128_set_encrypt_key(&aes->cipher.a128, derived);
+        aes->encrypt = (nettle_cipher_func*)aes128_encrypt;
+        break;
+      case 2 :
+        aes192_set_encrypt_key(&aes->cipher.a192, derived);
+        aes->encrypt = (nettle_cipher_func*)aes192_encrypt;
+        break;
+      default :
+        aes256_set_encrypt_key(&aes->cipher.a256, derived);
+        aes->encrypt = (nettle_cipher_func*)aes256_encrypt;
+        break;
+    }
+    hmac_sha1_set_key(&aes->hmac, uKeySize, derived + uKeySize);
+    memset(derived, 0, sizeof(derived));
+
+    aes->version = (int)s->cur_file_info_internal.aes_version;
+    memset(aes->counter, 0, sizeof(aes->counter));
+    aes->counter[0] = 1;
+    aes->keystream_pos = (uInt)sizeof(aes->keystream);
+
+    pfile_in_zip_read_info->aes = aes;
+    pfile_in_zip_read_info->pos_in_zipfile += uSaltSize+UNZ_AES_PWVERIFY_SIZE;
+    pfile_in_zip_read_info->rest_read_compressed -=
+            uSaltSize+UNZ_AES_PWVERIFY_SIZE+UNZ_AES_AUTHCODE_SIZE;
+    return UNZ_OK;
+}
+
+/*
+  Compare the authentication code stored after the encrypted data with the
+  HMAC of the data that was read; call once all of it has been read.
+*/
+local int unz64local_CheckAesAuth OF((file_in_zip64_read_info_s* pfile_in_zip_read_info));
+local int unz64local_CheckAesAuth (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    unsigned char stored[UNZ_AES_AUTHCODE_SIZE];
+    unsigned char computed[UNZ_AES_AUTHCODE_SIZE];
+
+    if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                pfile_in_zip_read_info->pos_in_zipfile +
+                   pfile_in_zip_read_info->byte_before_the_zipfile,
+                ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return UNZ_ERRNO;
+    if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                stored, sizeof(stored))!=sizeof(stored))
+        return UNZ_ERRNO;
+
+    hmac_sha1_digest(&pfile_in_zip_read_info->aes->hmac, sizeof(computed), computed);
+    if (memcmp(stored, computed, sizeof(stored))!=0)
+        return UNZ_AUTHERROR;
+    return UNZ_OK;
+}
+#endif
+
+#ifdef HAVE_LZMA
+/*
+  The compressed data of a LZMA entry starts with a header of its own:
+  2 bytes LZMA SDK version, 2 bytes size of the properties, then the
+  5 bytes of LZMA1 properties. Read it and set up a raw LZMA1 decoder
+  for the data that follows it.
+*/
+local int unz64local_InitLzma OF((file_in_zip64_read_info_s* pfile_in_zip_read_info));
+local int unz64local_InitLzma (file_in_zip64_read_info_s* pfile_in_zip_read_info)
+{
+    lzma_stream init = LZMA_STREAM_INIT;
+    lzma_filter filters[2];
+    unsigned char header[4];
+    unsigned char props[5];
+    uInt uPropsSize;
+    lzma_ret ret;
+
+    if (pfile_in_zip_read_info->rest_read_compressed < sizeof(header)+sizeof(props))
+        return UNZ_BADZIPFILE;
+
+    if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                pfile_in_zip_read_info->pos_in_zipfile +
+                   pfile_in_zip_read_info->byte_before_the_zipfile,
+                ZLIB_FILEFUNC_SEEK_SET)!=0)
+        return UNZ_ERRNO;
+    if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                header, sizeof(header))!=sizeof(header))
+        return UNZ_ERRNO;
+#ifdef HAVE_NETTLE
+    if (pfile_in_zip_read_info->aes!=NULL)
+        unz64local_AesDecrypt(pfile_in_zip_read_info->aes, header, sizeof(header));
+#endif
+
+    uPropsSize = (uInt)header[2] | ((uInt)header[3] << 8);
+    if (uPropsSize != sizeof(props))
+        return UNZ_BADZIPFILE;
+
+    if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                pfile_in_zip_read_info->filestream,
+                props, sizeof(props))!=sizeof(props))
+        return UNZ_ERRNO;
+#ifdef HAVE_NETTLE
+    if (pfile_in_zip_read_info->aes!=NULL)
+        unz64local_AesDecrypt(pfile_in_zip_read_info->aes, props, sizeof(props));
+#endif
+
+    filters[0].id = LZMA_FILTER_LZMA1;
+    filters[0].options = NULL;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = NULL;
+    if (lzma_properties_decode(&filters[0], NULL, props, sizeof(props)) != LZMA_OK)
+        return UNZ_BADZIPFILE;
+
+    /* the end of data marker is optional (flag bit 1), the decoder is
+       simply not asked for more than the uncompressed size */
+    pfile_in_zip_read_info->lstream = init;
+    ret = lzma_raw_decoder(&pfile_in_zip_read_info->lstream, filters);
+    free(filters[0].options);
+    if (ret != LZMA_OK)
+        return (ret == LZMA_MEM_ERROR) ? Z_MEM_ERROR : UNZ_INTERNALERROR;
+
+    pfile_in_zip_read_info->pos_in_zipfile += sizeof(header)+sizeof(props);
+    pfile_in_zip_read_info->rest_read_compressed -= sizeof(header)+sizeof(props);
+    return UNZ_OK;
+}
+#endif
+
 /*
   Open for reading data the current file in the zipfile.
   If there is no error and the file is opened, the return value is UNZ_OK.
@@ -1478,11 +1907,9 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     file_in_zip64_read_info_s* pfile_in_zip_read_info;
     ZPOS64_T offset_local_extrafield;  /* offset of the local extra field */
     uInt  size_local_extrafield;    /* size of the local extra field */
+    uLong uMethod;                  /* compression method of the (decrypted) data */
 #    ifndef NOUNCRYPT
     char source[12];
-#    else
-    if (password != NULL)
-        return UNZ_PARAMERROR;
 #    endif
 
     if (file==NULL)
@@ -1497,26 +1924,29 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     if (unz64local_CheckCurrentFileCoherencyHeader(s,&iSizeVar, &offset_local_extrafield,&size_local_extrafield)!=UNZ_OK)
         return UNZ_BADZIPFILE;
 
-    pfile_in_zip_read_info = (file_in_zip64_read_info_s*)ALLOC(sizeof(file_in_zip64_read_info_s));
+    uMethod = s->cur_file_info.compression_method;
+#ifdef HAVE_NETTLE
+    if ((uMethod==Z_AESED) && (!raw))
+    {
+        if (s->cur_file_info_internal.aes_version==0)
+            return UNZ_BADZIPFILE;
+        uMethod = s->cur_file_info_internal.aes_method;
+    }
+#endif
+
+    pfile_in_zip_read_info = unz64local_AllocReadInfo(s);
     if (pfile_in_zip_read_info==NULL)
         return UNZ_INTERNALERROR;
 
-    pfile_in_zip_read_info->read_buffer=(char*)ALLOC(UNZ_BUFSIZE);
     pfile_in_zip_read_info->offset_local_extrafield = offset_local_extrafield;
     pfile_in_zip_read_info->size_local_extrafield = size_local_extrafield;
     pfile_in_zip_read_info->pos_local_extrafield=0;
     pfile_in_zip_read_info->raw=raw;
 
-    if (pfile_in_zip_read_info->read_buffer==NULL)
-    {
-        TRYFREE(pfile_in_zip_read_info);
-        return UNZ_INTERNALERROR;
-    }
-
     pfile_in_zip_read_info->stream_initialised=0;
 
     if (method!=NULL)
-        *method = (int)s->cur_file_info.compression_method;
+        *method = (int)uMethod;
 
     if (level!=NULL)
     {
@@ -1529,25 +1959,41 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
         }
     }
 
-    if ((s->cur_file_info.compression_method!=0) &&
+    if ((uMethod!=0) &&
 /* #ifdef HAVE_BZIP2 */
-        (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
+        (uMethod!=Z_BZIP2ED) &&
 /* #endif */
-        (s->cur_file_info.compression_method!=Z_DEFLATED))
+#ifdef HAVE_LZMA
+        (uMethod!=Z_LZMAED) &&
+#endif
+#ifdef HAVE_ZSTD
+        (uMethod!=Z_ZSTDED) &&
+#endif
+#ifdef HAVE_NETTLE
+        ((uMethod!=Z_AESED) || (!raw)) &&
+#endif
+        (uMethod!=Z_DEFLATED))
 
         err=UNZ_BADZIPFILE;
 
+    /* no decoder for it: reading would inflate with a stream never set up */
+    if (err!=UNZ_OK)
+    {
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
+        return err;
+    }
+
     pfile_in_zip_read_info->crc32_wait=s->cur_file_info.crc;
     pfile_in_zip_read_info->crc32=0;
     pfile_in_zip_read_info->total_out_64=0;
-    pfile_in_zip_read_info->compression_method = s->cur_file_info.compression_method;
+    pfile_in_zip_read_info->compression_method = uMethod;
     pfile_in_zip_read_info->filestream=s->filestream;
     pfile_in_zip_read_info->z_filefunc=s->z_filefunc;
     pfile_in_zip_read_info->byte_before_the_zipfile=s->byte_before_the_zipfile;
 
     pfile_in_zip_read_info->stream.total_out = 0;
 
-    if ((s->cur_file_info.compression_method==Z_BZIP2ED) && (!raw))
+    if ((uMethod==Z_BZIP2ED) && (!raw))
     {
 #ifdef HAVE_BZIP2
       pfile_in_zip_read_info->bstream.bzalloc = (void *(*) (void *, int, int))0;
@@ -1555,9 +2001,13 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
       pfile_in_zip_read_info->bstream.opaque = (voidpf)0;
       pfile_in_zip_read_info->bstream.state = (voidpf)0;
 
-      pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
-      pfile_in_zip_read_info->stream.zfree = (free_func)0;
-      pfile_in_zip_read_info->stream.opaque = (voidpf)0;
+      /* the stream may still hold a pooled inflate state, keep its allocator */
+      if (!pfile_in_zip_read_info->inflate_ready)
+      {
+        pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
+        pfile_in_zip_read_info->stream.zfree = (free_func)0;
+        pfile_in_zip_read_info->stream.opaque = (voidpf)0;
+      }
       pfile_in_zip_read_info->stream.next_in = (voidpf)0;
       pfile_in_zip_read_info->stream.avail_in = 0;
 
@@ -1566,27 +2016,34 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
         pfile_in_zip_read_info->stream_initialised=Z_BZIP2ED;
       else
       {
-        TRYFREE(pfile_in_zip_read_info);
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
         return err;
       }
 #else
       pfile_in_zip_read_info->raw=1;
 #endif
     }
-    else if ((s->cur_file_info.compression_method==Z_DEFLATED) && (!raw))
+    else if ((uMethod==Z_DEFLATED) && (!raw))
     {
-      pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
-      pfile_in_zip_read_info->stream.zfree = (free_func)0;
-      pfile_in_zip_read_info->stream.opaque = (voidpf)0;
       pfile_in_zip_read_info->stream.next_in = 0;
       pfile_in_zip_read_info->stream.avail_in = 0;
 
-      err=inflateInit2(&pfile_in_zip_read_info->stream, -MAX_WBITS);
+      if (pfile_in_zip_read_info->inflate_ready)
+        err=inflateReset(&pfile_in_zip_read_info->stream);
+      else
+      {
+        pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
+        pfile_in_zip_read_info->stream.zfree = (free_func)0;
+        pfile_in_zip_read_info->stream.opaque = (voidpf)0;
+
+        err=inflateInit2(&pfile_in_zip_read_info->stream, -MAX_WBITS);
+        pfile_in_zip_read_info->inflate_ready = (err == Z_OK);
+      }
       if (err == Z_OK)
         pfile_in_zip_read_info->stream_initialised=Z_DEFLATED;
       else
       {
-        TRYFREE(pfile_in_zip_read_info);
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
         return err;
       }
         /* windowBits is passed < 0 to tell that there is no zlib header.
@@ -1597,6 +2054,21 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
          * size of both compressed and uncompressed data
          */
     }
+#ifdef HAVE_ZSTD
+    else if ((uMethod==Z_ZSTDED) && (!raw))
+    {
+      pfile_in_zip_read_info->zstream = ZSTD_createDStream();
+      if ((pfile_in_zip_read_info->zstream != NULL) &&
+          (!ZSTD_isError(ZSTD_initDStream(pfile_in_zip_read_info->zstream))))
+        pfile_in_zip_read_info->stream_initialised=Z_ZSTDED;
+      else
+      {
+        ZSTD_freeDStream(pfile_in_zip_read_info->zstream);
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
+        return Z_MEM_ERROR;
+      }
+    }
+#endif
     pfile_in_zip_read_info->rest_read_compressed =
             s->cur_file_info.compressed_size ;
     pfile_in_zip_read_info->rest_read_uncompressed =
@@ -1607,13 +2079,40 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
             s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER +
               iSizeVar;
 
+#ifdef HAVE_NETTLE
+    /* before the LZMA header, which is encrypted as well */
+    if ((s->cur_file_info.compression_method==Z_AESED) && (!raw))
+    {
+      err=unz64local_InitAes(s, pfile_in_zip_read_info, password);
+      if (err != UNZ_OK)
+      {
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
+        return err;
+      }
+    }
+#endif
+
+#ifdef HAVE_LZMA
+    if ((uMethod==Z_LZMAED) && (!raw))
+    {
+      err=unz64local_InitLzma(pfile_in_zip_read_info);
+      if (err == UNZ_OK)
+        pfile_in_zip_read_info->stream_initialised=Z_LZMAED;
+      else
+      {
+        unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
+        return err;
+      }
+    }
+#endif
+
     pfile_in_zip_read_info->stream.avail_in = (uInt)0;
 
     s->pfile_in_zip_read = pfile_in_zip_read_info;
                 s->encrypted = 0;
 
 #    ifndef NOUNCRYPT
-    if (password != NULL)
+    if ((password != NULL) && (s->cur_file_info.compression_method!=Z_AESED))
     {
         int i;
         s->pcrc_32_tab = get_crc_table();
@@ -1671,6 +2170,125 @@ extern ZPOS64_T ZEXPORT unzGetCurrentFileZStreamPos64( unzFile file)
 
 /** Addition for GDAL : END */
 
+/*
+  Account for len bytes of output of the current file: add them to its
+  CRC, or only count them when CRCs are not checked
+*/
+local void unz64local_UpdateCrc OF((unz64_s* s,
+                                    file_in_zip64_read_info_s* pfile_in_zip_read_info,
+                                    const Bytef* buf,
+                                    uInt len));
+local void unz64local_UpdateCrc (unz64_s* s,
+                                 file_in_zip64_read_info_s* pfile_in_zip_read_info,
+                                 const Bytef* buf,
+                                 uInt len)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec before, after;
+#endif
+
+    if (s->crc_policy!=UNZ_CRC_INLINE)
+    {
+        s->crc_stats.bytes_skipped += len;
+        return;
+    }
+
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &before);
+#endif
+    pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32, buf, len);
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    s->crc_stats.nsec += (ZPOS64_T)(after.tv_sec - before.tv_sec) * 1000000000 +
+                         after.tv_nsec - before.tv_nsec;
+#endif
+    s->crc_stats.bytes_checked += len;
+}
+
+#ifdef HAVE_LIBDEFLATE
+/*
+  Decode a whole deflated entry with a single libdeflate call, when nothing
+  has been read from it yet and buf can hold all of it. The compressed data
+  is read with one I/O request.
+  return 1 and set *pResult (bytes read or error code) if the entry was
+  handled, 0 if the caller must fall back to zlib
+*/
+local int unz64local_ReadOneShot OF((unz64_s* s, voidp buf, unsigned len, int* pResult));
+local int unz64local_ReadOneShot (unz64_s* s, voidp buf, unsigned len, int* pResult)
+{
+    file_in_zip64_read_info_s* pfile_in_zip_read_info = s->pfile_in_zip_read;
+    enum libdeflate_result result;
+    uLong uReadThis;
+    uLong uOut;
+    char* in;
+
+    if ((pfile_in_zip_read_info->compression_method!=Z_DEFLATED) ||
+        (pfile_in_zip_read_info->raw) ||
+        (s->encrypted) ||
+        (pfile_in_zip_read_info->total_out_64!=0) ||
+        (pfile_in_zip_read_info->stream.avail_in!=0) ||
+        (pfile_in_zip_read_info->rest_read_uncompressed==0) ||
+        (pfile_in_zip_read_info->rest_read_uncompressed>len) ||
+        (pfile_in_zip_read_info->rest_read_compressed==0) ||
+        (pfile_in_zip_read_info->rest_read_compressed>UNZ_ONESHOT_MAXSIZE))
+        return 0;
+
+    if (s->deflate_decompressor==NULL)
+    {
+        s->deflate_decompressor = libdeflate_alloc_decompressor();
+        if (s->deflate_decompressor==NULL)
+            return 0;
+    }
+
+    uReadThis = (uLong)pfile_in_zip_read_info->rest_read_compressed;
+    uOut = (uLong)pfile_in_zip_read_info->rest_read_uncompressed;
+    in = (char*)ALLOC(uReadThis);
+    if (in==NULL)
+        return 0;
+
+    if ((ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                 pfile_in_zip_read_info->filestream,
+                 pfile_in_zip_read_info->pos_in_zipfile +
+                    pfile_in_zip_read_info->byte_before_the_zipfile,
+                 ZLIB_FILEFUNC_SEEK_SET)!=0) ||
+        (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                 pfile_in_zip_read_info->filestream,
+                 in, uReadThis)!=uReadThis))
+    {
+        TRYFREE(in);
+        *pResult = UNZ_ERRNO;
+        return 1;
+    }
+#ifdef HAVE_NETTLE
+    if (pfile_in_zip_read_info->aes!=NULL)
+        unz64local_AesDecrypt(pfile_in_zip_read_info->aes, (unsigned char*)in, (uInt)uReadThis);
+#endif
+
+    /* a NULL actual size makes anything but exactly uOut bytes an error */
+    result = libdeflate_deflate_decompress(s->deflate_decompressor,
+                                           in, uReadThis, buf, uOut, NULL);
+    TRYFREE(in);
+
+    pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+    pfile_in_zip_read_info->rest_read_compressed = 0;
+
+    if (result!=LIBDEFLATE_SUCCESS)
+    {
+        *pResult = ((result==LIBDEFLATE_SHORT_OUTPUT) ||
+                    (result==LIBDEFLATE_INSUFFICIENT_SPACE)) ? UNZ_SIZEERROR : Z_DATA_ERROR;
+        return 1;
+    }
+
+    unz64local_UpdateCrc(s, pfile_in_zip_read_info, (const Bytef*)buf, (uInt)uOut);
+    pfile_in_zip_read_info->total_out_64 += uOut;
+    pfile_in_zip_read_info->rest_read_uncompressed -= uOut;
+    pfile_in_zip_read_info->stream.total_out += uOut;
+
+    *pResult = (int)uOut;
+    return 1;
+}
+#endif
+
 /*
   Read bytes from the current file.
   buf contain buffer where data must be copied
@@ -1701,6 +2319,11 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
     if (len==0)
         return 0;
 
+#ifdef HAVE_LIBDEFLATE
+    if (unz64local_ReadOneShot(s, buf, len, &err))
+        return err;
+#endif
+
     pfile_in_zip_read_info->stream.next_out = (Bytef*)buf;
 
     pfile_in_zip_read_info->stream.avail_out = (uInt)len;
@@ -1739,6 +2362,12 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
                       uReadThis)!=uReadThis)
                 return UNZ_ERRNO;
 
+#ifdef HAVE_NETTLE
+            if (pfile_in_zip_read_info->aes!=NULL)
+                unz64local_AesDecrypt(pfile_in_zip_read_info->aes,
+                                      (unsigned char*)pfile_in_zip_read_info->read_buffer,
+                                      uReadThis);
+#endif
 
 #            ifndef NOUNCRYPT
             if(s->encrypted)
@@ -1763,7 +2392,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
         if ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw))
         {
-            uInt uDoCopy,i ;
+            uInt uDoCopy ;
 
             if ((pfile_in_zip_read_info->stream.avail_in == 0) &&
                 (pfile_in_zip_read_info->rest_read_compressed == 0))
@@ -1775,15 +2404,14 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             else
                 uDoCopy = pfile_in_zip_read_info->stream.avail_in ;
 
-            for (i=0;i<uDoCopy;i++)
-                *(pfile_in_zip_read_info->stream.next_out+i) =
-                        *(pfile_in_zip_read_info->stream.next_in+i);
+            memcpy(pfile_in_zip_read_info->stream.next_out,
+                   pfile_in_zip_read_info->stream.next_in, uDoCopy);
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
-                                pfile_in_zip_read_info->stream.next_out,
-                                uDoCopy);
+            unz64local_UpdateCrc(s, pfile_in_zip_read_info,
+                                 pfile_in_zip_read_info->stream.next_out,
+                                 uDoCopy);
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
             pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
             pfile_in_zip_read_info->stream.avail_out -= uDoCopy;
@@ -1818,7 +2446,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,bufBefore, (uInt)(uOutThis));
+            unz64local_UpdateCrc(s, pfile_in_zip_read_info, bufBefore, (uInt)(uOutThis));
             pfile_in_zip_read_info->rest_read_uncompressed -= uOutThis;
             iRead += (uInt)(uTotalOutAfter - uTotalOutBefore);
 
@@ -1835,6 +2463,91 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
               break;
 #endif
         } // end Z_BZIP2ED
+#ifdef HAVE_LZMA
+        else if (pfile_in_zip_read_info->compression_method==Z_LZMAED)
+        {
+            lzma_stream* ls = &pfile_in_zip_read_info->lstream;
+            const Bytef *bufBefore;
+            uLong uInThis,uOutThis;
+            lzma_ret ret;
+
+            ls->next_in   = pfile_in_zip_read_info->stream.next_in;
+            ls->avail_in  = pfile_in_zip_read_info->stream.avail_in;
+            ls->next_out  = pfile_in_zip_read_info->stream.next_out;
+            ls->avail_out = pfile_in_zip_read_info->stream.avail_out;
+
+            bufBefore = pfile_in_zip_read_info->stream.next_out;
+
+            ret=lzma_code(ls, LZMA_RUN);
+
+            uInThis = (uLong)(pfile_in_zip_read_info->stream.avail_in - ls->avail_in);
+            uOutThis = (uLong)(ls->next_out - bufBefore);
+
+            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
+
+            unz64local_UpdateCrc(s, pfile_in_zip_read_info, bufBefore, (uInt)(uOutThis));
+            pfile_in_zip_read_info->rest_read_uncompressed -= uOutThis;
+            iRead += (uInt)uOutThis;
+
+            pfile_in_zip_read_info->stream.next_in    = (Bytef*)ls->next_in;
+            pfile_in_zip_read_info->stream.avail_in   = (uInt)ls->avail_in;
+            pfile_in_zip_read_info->stream.total_in  += uInThis;
+            pfile_in_zip_read_info->stream.next_out   = ls->next_out;
+            pfile_in_zip_read_info->stream.avail_out  = (uInt)ls->avail_out;
+            pfile_in_zip_read_info->stream.total_out += uOutThis;
+
+            if (ret==LZMA_STREAM_END)
+              return (iRead==0) ? UNZ_EOF : iRead;
+            if (ret!=LZMA_OK)
+            {
+              err = (ret==LZMA_MEM_ERROR) ? Z_MEM_ERROR : Z_DATA_ERROR;
+              break;
+            }
+        } // end Z_LZMAED
+#endif
+#ifdef HAVE_ZSTD
+        else if (pfile_in_zip_read_info->compression_method==Z_ZSTDED)
+        {
+            ZSTD_inBuffer in;
+            ZSTD_outBuffer out;
+            size_t ret;
+
+            in.src   = pfile_in_zip_read_info->stream.next_in;
+            in.size  = pfile_in_zip_read_info->stream.avail_in;
+            in.pos   = 0;
+            out.dst  = pfile_in_zip_read_info->stream.next_out;
+            out.size = pfile_in_zip_read_info->stream.avail_out;
+            out.pos  = 0;
+
+            ret=ZSTD_decompressStream(pfile_in_zip_read_info->zstream, &out, &in);
+
+            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + out.pos;
+
+            unz64local_UpdateCrc(s, pfile_in_zip_read_info,
+                                 pfile_in_zip_read_info->stream.next_out, (uInt)out.pos);
+            pfile_in_zip_read_info->rest_read_uncompressed -= out.pos;
+            iRead += (uInt)out.pos;
+
+            pfile_in_zip_read_info->stream.next_in   += in.pos;
+            pfile_in_zip_read_info->stream.avail_in  -= (uInt)in.pos;
+            pfile_in_zip_read_info->stream.total_in  += (uLong)in.pos;
+            pfile_in_zip_read_info->stream.next_out  += out.pos;
+            pfile_in_zip_read_info->stream.avail_out -= (uInt)out.pos;
+            pfile_in_zip_read_info->stream.total_out += (uLong)out.pos;
+
+            if (ZSTD_isError(ret))
+            {
+              err = Z_DATA_ERROR;
+              break;
+            }
+            /* no progress: the compressed data ended before the frame did */
+            if ((in.pos==0) && (out.pos==0))
+            {
+              err = Z_BUF_ERROR;
+              break;
+            }
+        } // end Z_ZSTDED
+#endif
         else
         {
             ZPOS64_T uTotalOutBefore,uTotalOutAfter;
@@ -1861,9 +2574,8 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uOutThis;
 
-            pfile_in_zip_read_info->crc32 =
-                crc32(pfile_in_zip_read_info->crc32,bufBefore,
-                        (uInt)(uOutThis));
+            unz64local_UpdateCrc(s, pfile_in_zip_read_info, bufBefore,
+                                 (uInt)(uOutThis));
 
             pfile_in_zip_read_info->rest_read_uncompressed -=
                 uOutThis;
@@ -1883,6 +2595,168 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 }
 
 
+/*
+  Read the compressed data of a stored or deflated entry with one I/O
+  request and decode it with one call, straight into buf: stored data is
+  read into buf itself, deflated data is inflated with Z_FINISH.
+  return UNZ_OK, UNZ_SIZEERROR if the data does not decode to exactly
+  the declared size or the deflate stream ends early, UNZ_ERRNO if the
+  compressed data cannot be read, Z_DATA_ERROR if it is corrupt
+*/
+local int unz64local_ReadWhole OF((unz64_s* s, voidp buf));
+local int unz64local_ReadWhole (unz64_s* s, voidp buf)
+{
+    file_in_zip64_read_info_s* pfile_in_zip_read_info = s->pfile_in_zip_read;
+    uLong uReadThis = (uLong)pfile_in_zip_read_info->rest_read_compressed;
+    uInt uSize = (uInt)pfile_in_zip_read_info->rest_read_uncompressed;
+    uInt uOut = uSize;
+    char* in = (char*)buf;
+    Bytef extra;
+    int err = UNZ_OK;
+
+    if ((pfile_in_zip_read_info->compression_method==0) && (uReadThis!=uSize))
+        return UNZ_SIZEERROR;
+
+    if (pfile_in_zip_read_info->compression_method!=0)
+    {
+        in = (char*)ALLOC(uReadThis ? uReadThis : 1);
+        if (in==NULL)
+            return UNZ_INTERNALERROR;
+    }
+
+    if ((ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                 pfile_in_zip_read_info->filestream,
+                 pfile_in_zip_read_info->pos_in_zipfile +
+                    pfile_in_zip_read_info->byte_before_the_zipfile,
+                 ZLIB_FILEFUNC_SEEK_SET)!=0) ||
+        (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                 pfile_in_zip_read_info->filestream,
+                 in, uReadThis)!=uReadThis))
+        err = UNZ_ERRNO;
+#ifdef HAVE_NETTLE
+    else if (pfile_in_zip_read_info->aes!=NULL)
+        unz64local_AesDecrypt(pfile_in_zip_read_info->aes, (unsigned char*)in, (uInt)uReadThis);
+#endif
+
+    if ((err==UNZ_OK) && (pfile_in_zip_read_info->compression_method!=0))
+    {
+        pfile_in_zip_read_info->stream.next_in = (Bytef*)in;
+        pfile_in_zip_read_info->stream.avail_in = (uInt)uReadThis;
+        /* an empty entry still has to reach the end of its stream */
+        pfile_in_zip_read_info->stream.next_out = (uSize!=0) ? (Bytef*)buf : &extra;
+        pfile_in_zip_read_info->stream.avail_out = uSize;
+
+        err = inflate(&pfile_in_zip_read_info->stream, Z_FINISH);
+        uOut = uSize - pfile_in_zip_read_info->stream.avail_out;
+
+        if ((err==Z_BUF_ERROR) && (uOut<uSize) &&
+            (pfile_in_zip_read_info->stream.avail_in==0))
+            /* the input ran out before the stream ended: truncated */
+            err = UNZ_SIZEERROR;
+        else if ((err==Z_BUF_ERROR) && (uOut==uSize))
+        {
+            /* buf is full; fine if nothing but the end of the stream is left */
+            pfile_in_zip_read_info->stream.next_out = &extra;
+            pfile_in_zip_read_info->stream.avail_out = 1;
+            err = inflate(&pfile_in_zip_read_info->stream, Z_FINISH);
+            if (pfile_in_zip_read_info->stream.avail_out==0)
+                err = UNZ_SIZEERROR;
+        }
+
+        if (err==Z_STREAM_END)
+            err = (uOut==uSize) ? UNZ_OK : UNZ_SIZEERROR;
+        else if (err!=UNZ_SIZEERROR)
+            err = Z_DATA_ERROR;
+
+        pfile_in_zip_read_info->stream.next_in = NULL;
+        pfile_in_zip_read_info->stream.avail_in = 0;
+        TRYFREE(in);
+    }
+    else if (pfile_in_zip_read_info->compression_method==0)
+        pfile_in_zip_read_info->stream.total_out += uOut;
+
+    if (err==UNZ_OK)
+    {
+        unz64local_UpdateCrc(s, pfile_in_zip_read_info, (const Bytef*)buf, uOut);
+        pfile_in_zip_read_info->total_out_64 += uOut;
+        pfile_in_zip_read_info->rest_read_uncompressed -= uOut;
+    }
+    pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+    pfile_in_zip_read_info->rest_read_compressed = 0;
+
+    return err;
+}
+
+/*
+  Read the whole current file into buf, see unzip.h
+*/
+extern int ZEXPORT unzReadCurrentFileFully (unzFile file, voidp buf, ZPOS64_T len)
+{
+    int err=UNZ_OK;
+    unz64_s* s;
+    file_in_zip64_read_info_s* pfile_in_zip_read_info;
+    ZPOS64_T uSize;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if ((pfile_in_zip_read_info==NULL) ||
+        (pfile_in_zip_read_info->raw) ||
+        (pfile_in_zip_read_info->total_out_64!=0) ||
+        (pfile_in_zip_read_info->stream.avail_in!=0))
+        return UNZ_PARAMERROR;
+
+    uSize = pfile_in_zip_read_info->rest_read_uncompressed;
+    if (len<uSize)
+        return UNZ_PARAMERROR;
+    if ((uSize==0) && (pfile_in_zip_read_info->compression_method==0))
+        return (pfile_in_zip_read_info->rest_read_compressed==0) ? UNZ_OK : UNZ_SIZEERROR;
+
+#ifdef HAVE_LIBDEFLATE
+    if ((uSize<=0x7fffffff) && (unz64local_ReadOneShot(s, buf, (unsigned)uSize, &err)))
+        err = (err<0) ? err : UNZ_OK;
+    else
+#endif
+    if (((pfile_in_zip_read_info->compression_method==0) ||
+         (pfile_in_zip_read_info->compression_method==Z_DEFLATED)) &&
+        (!s->encrypted) &&
+        (pfile_in_zip_read_info->rest_read_compressed<=UNZ_ONESHOT_MAXSIZE) &&
+        (uSize<=0x7fffffff))
+        err = unz64local_ReadWhole(s, buf);
+    else
+    {
+        /* other methods, or too large to hold the compressed data too */
+        ZPOS64_T uDone = 0;
+        while ((err==UNZ_OK) && (uDone<uSize))
+        {
+            unsigned uChunk = (uSize-uDone > 0x40000000) ? 0x40000000 : (unsigned)(uSize-uDone);
+            int iRead = unzReadCurrentFile(file, (char*)buf + uDone, uChunk);
+            if (iRead<0)
+                err = iRead;
+            else if (iRead==0)
+                err = UNZ_SIZEERROR;
+            else
+                uDone += (ZPOS64_T)iRead;
+        }
+    }
+
+    if ((err==UNZ_OK) && (pfile_in_zip_read_info->rest_read_uncompressed!=0))
+        err = UNZ_SIZEERROR;
+
+    if ((err==UNZ_OK) &&
+        (s->crc_policy==UNZ_CRC_INLINE) &&
+#ifdef HAVE_NETTLE
+        ((pfile_in_zip_read_info->aes==NULL) || (pfile_in_zip_read_info->aes->version!=2)) &&
+#endif
+        (pfile_in_zip_read_info->crc32!=pfile_in_zip_read_info->crc32_wait))
+        err = UNZ_CRCERROR;
+
+    return err;
+}
+
+
 /*
   Give the current position in uncompressed data
 */
@@ -2000,6 +2874,7 @@ extern int ZEXPORT unzGetLocalExtrafield (unzFile file, voidp buf, unsigned len)
 /*
   Close the file in zip opened with unzipOpenCurrentFile
   Return UNZ_CRCERROR if all the file was read but the CRC is not good
+  Return UNZ_AUTHERROR if the authentication code of an AES file is not good
 */
 extern int ZEXPORT unzCloseCurrentFile (unzFile file)
 {
@@ -2017,25 +2892,44 @@ extern int ZEXPORT unzCloseCurrentFile (unzFile file)
 
 
     if ((pfile_in_zip_read_info->rest_read_uncompressed == 0) &&
-        (!pfile_in_zip_read_info->raw))
+        (!pfile_in_zip_read_info->raw) &&
+        (s->crc_policy == UNZ_CRC_INLINE))
     {
         if (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
             err=UNZ_CRCERROR;
     }
 
+#ifdef HAVE_NETTLE
+    /* AE-2 stores no CRC, the authentication code replaces it; it is
+       checked whatever the CRC policy, it is what makes the data trusted */
+    if (pfile_in_zip_read_info->aes != NULL)
+    {
+        if (pfile_in_zip_read_info->aes->version == 2)
+            err=UNZ_OK;
+        if ((pfile_in_zip_read_info->rest_read_uncompressed == 0) &&
+            (pfile_in_zip_read_info->rest_read_compressed == 0) &&
+            (err == UNZ_OK))
+            err=unz64local_CheckAesAuth(pfile_in_zip_read_info);
+    }
+#endif
 
-    TRYFREE(pfile_in_zip_read_info->read_buffer);
-    pfile_in_zip_read_info->read_buffer = NULL;
-    if (pfile_in_zip_read_info->stream_initialised == Z_DEFLATED)
-        inflateEnd(&pfile_in_zip_read_info->stream);
+
+    /* the inflate state and read buffer are kept for the next file */
 #ifdef HAVE_BZIP2
-    else if (pfile_in_zip_read_info->stream_initialised == Z_BZIP2ED)
+    if (pfile_in_zip_read_info->stream_initialised == Z_BZIP2ED)
         BZ2_bzDecompressEnd(&pfile_in_zip_read_info->bstream);
 #endif
+#ifdef HAVE_LZMA
+    if (pfile_in_zip_read_info->stream_initialised == Z_LZMAED)
+        lzma_end(&pfile_in_zip_read_info->lstream);
+#endif
+#ifdef HAVE_ZSTD
+    if (pfile_in_zip_read_info->stream_initialised == Z_ZSTDED)
+        ZSTD_freeDStream(pfile_in_zip_read_info->zstream);
+#endif
 
 
-    pfile_in_zip_read_info->stream_initialised = 0;
-    TRYFREE(pfile_in_zip_read_info);
+    unz64local_ReleaseReadInfo(s, pfile_in_zip_read_info);
 
     s->pfile_in_zip_read=NULL;
 
@@ -2123,3 +3017,36 @@ extern int ZEXPORT unzSetOffset (unzFile file, uLong pos)
 {
     return unzSetOffset64(file,pos);
 }
+
+/*
+  Set whether the CRC of the entries read is computed and checked
+*/
+extern int ZEXPORT unzSetCrcPolicy (unzFile file, int policy)
+{
+    unz64_s* s;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    if ((policy!=UNZ_CRC_INLINE) && (policy!=UNZ_CRC_SKIP))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+
+    /* the file being read keeps the policy it was opened with */
+    if (s->pfile_in_zip_read!=NULL)
+        return UNZ_PARAMERROR;
+
+    s->crc_policy = policy;
+    return UNZ_OK;
+}
+
+extern int ZEXPORT unzGetCrcStats (unzFile file, unz_crc_stats* stats)
+{
+    unz64_s* s;
+
+    if ((file==NULL) || (stats==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+
+    *stats = s->crc_stats;
+    return UNZ_OK;
+}
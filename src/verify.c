@@ -0,0 +1,507 @@
+/*
+ * File Name: verify.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// local include files, between " "
+#include "log.h"
+#include "cache.h"
+#include "spill.h"
+#include "unzip.h"
+#include "verify.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef enum
+{
+    STATE_UNKNOWN = 0,
+    STATE_PENDING,              // queued for the background verifier
+    STATE_VERIFIED,
+    STATE_FAILED
+} ArchiveState;
+
+typedef struct
+{
+    ArchiveState state;
+    guint64      size;          // identity of the archive file when it was verified
+    gint64       mtime;
+} ArchiveInfo;
+
+
+//----------------------------------------------------------------------------
+// Global Constants
+//----------------------------------------------------------------------------
+
+#define RECORD_NAME     "verified"
+#define READ_CHUNK      (64 * 1024)
+
+static const gchar *mode_names[] = { "inline", "deferred", "trusted" };
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static GStaticMutex g_verify_mutex = G_STATIC_MUTEX_INIT;
+static VerifyMode   g_mode         = VERIFY_INLINE;
+static GHashTable   *g_archives    = NULL;  // path -> ArchiveInfo
+static gchar        *g_record_file = NULL;
+static gchar        *g_password    = NULL;  // for AES encrypted entries
+static GAsyncQueue  *g_queue       = NULL;  // paths to verify
+static GThread      *g_thread      = NULL;
+static VerifyStats  g_stats;
+
+static gchar        g_stop_marker;          // pushed on g_queue to stop the thread
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static gpointer     verify_thread   (gpointer data);
+static gboolean     verify_archive  (const gchar *archive, guint64 *bytes);
+static ArchiveInfo *get_info        (const gchar *archive, guint64 size, gint64 mtime);
+static gboolean     stat_archive    (const gchar *archive, guint64 *size, gint64 *mtime);
+static void         load_records    (void);
+static void         save_records    (void);
+static void         append_record   (gpointer key, gpointer value, gpointer user_data);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+void verify_init(VerifyMode mode, const gchar *password)
+{
+    LOGPRINTF("mode [%s]", verify_mode_name(mode));
+
+    g_static_mutex_lock(&g_verify_mutex);
+    g_mode        = mode;
+    g_archives    = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_record_file = g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, RECORD_NAME, NULL);
+    g_password    = g_strdup(password);
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.mode  = mode;
+    if (mode != VERIFY_INLINE)
+    {
+        load_records();
+    }
+    g_static_mutex_unlock(&g_verify_mutex);
+
+    if (mode != VERIFY_INLINE)
+    {
+        g_queue  = g_async_queue_new();
+        g_thread = g_thread_create(&verify_thread, NULL, TRUE, NULL);
+        if (g_thread == NULL)
+        {
+            // deferring without a verifier would never check anything
+            ERRORPRINTF("cannot start verifier, checking CRCs inline");
+            g_async_queue_unref(g_queue);
+            g_queue = NULL;
+            g_static_mutex_lock(&g_verify_mutex);
+            g_mode = g_stats.mode = VERIFY_INLINE;
+            g_static_mutex_unlock(&g_verify_mutex);
+        }
+    }
+}
+
+
+void verify_destroy(void)
+{
+    LOGPRINTF("entry");
+
+    if (g_thread)
+    {
+        // the marker is queued behind pending archives; drop those first
+        gpointer item;
+        while ((item = g_async_queue_try_pop(g_queue)) != NULL)
+        {
+            g_free(item);
+        }
+        g_async_queue_push(g_queue, &g_stop_marker);
+        g_thread_join(g_thread);
+        g_thread = NULL;
+        g_async_queue_unref(g_queue);
+        g_queue = NULL;
+    }
+
+    g_static_mutex_lock(&g_verify_mutex);
+    if (g_archives)
+    {
+        g_hash_table_destroy(g_archives);
+        g_archives = NULL;
+    }
+    g_free(g_record_file);
+    g_record_file = NULL;
+    g_free(g_password);
+    g_password    = NULL;
+    g_mode        = VERIFY_INLINE;
+    g_static_mutex_unlock(&g_verify_mutex);
+}
+
+
+gint verify_get_policy(const gchar *archive, guint64 size, gint64 mtime)
+{
+    ArchiveInfo *info   = NULL;
+    gint        policy  = UNZ_CRC_INLINE;
+    gboolean    enqueue = FALSE;
+
+    g_return_val_if_fail(archive, UNZ_CRC_INLINE);
+
+    g_static_mutex_lock(&g_verify_mutex);
+    if (g_mode != VERIFY_INLINE && g_archives)
+    {
+        info = get_info(archive, size, mtime);
+        switch (info->state)
+        {
+            case STATE_VERIFIED:
+                policy = UNZ_CRC_SKIP;
+                break;
+
+            case STATE_FAILED:
+                policy = UNZ_CRC_INLINE;
+                break;
+
+            case STATE_UNKNOWN:
+                info->state = STATE_PENDING;
+                g_stats.pending++;
+                enqueue = TRUE;
+                // fall through
+
+            case STATE_PENDING:
+                policy = (g_mode == VERIFY_DEFERRED) ? UNZ_CRC_SKIP : UNZ_CRC_INLINE;
+                break;
+        }
+    }
+    g_static_mutex_unlock(&g_verify_mutex);
+
+    if (enqueue)
+    {
+        g_async_queue_push(g_queue, g_strdup(archive));
+    }
+
+    return policy;
+}
+
+
+gboolean verify_parse_mode(const gchar *name, VerifyMode *mode)
+{
+    guint i;
+
+    g_return_val_if_fail(name && mode, FALSE);
+
+    for (i = 0; i < G_N_ELEMENTS(mode_names); i++)
+    {
+        if (g_ascii_strcasecmp(name, mode_names[i]) == 0)
+        {
+            *mode = (VerifyMode) i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+const gchar *verify_mode_name(VerifyMode mode)
+{
+    g_return_val_if_fail((guint) mode < G_N_ELEMENTS(mode_names), "unknown");
+
+    return mode_names[mode];
+}
+
+
+void verify_get_stats(VerifyStats *stats)
+{
+    g_return_if_fail(stats);
+
+    g_static_mutex_lock(&g_verify_mutex);
+    *stats = g_stats;
+    g_static_mutex_unlock(&g_verify_mutex);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static gpointer verify_thread(gpointer data)
+{
+    gchar       *archive = NULL;
+    ArchiveInfo *info    = NULL;
+    GTimer      *timer   = g_timer_new();
+    guint64     bytes;
+    guint64     size;
+    guint64     size_after;
+    gint64      mtime;
+    gint64      mtime_after;
+    gboolean    same;
+    gboolean    ok;
+
+    while ((archive = g_async_queue_pop(g_queue)) != &g_stop_marker)
+    {
+        LOGPRINTF("verifying [%s]", archive);
+
+        // the result only holds for the file that was read
+        bytes = 0;
+        same  = stat_archive(archive, &size, &mtime);
+        g_timer_start(timer);
+        ok = verify_archive(archive, &bytes);
+        g_timer_stop(timer);
+        same = same
+               && stat_archive(archive, &size_after, &mtime_after)
+               && size == size_after
+               && mtime == mtime_after;
+
+        g_static_mutex_lock(&g_verify_mutex);
+        g_stats.pending--;
+        g_stats.bytes += bytes;
+        g_stats.usec  += (guint64) (g_timer_elapsed(timer, NULL) * G_USEC_PER_SEC);
+
+        info = g_hash_table_lookup(g_archives, archive);
+        if (info && info->state == STATE_PENDING
+            && !(same && info->size == size && info->mtime == mtime))
+        {
+            // replaced meanwhile: queued again by the next read
+            LOGPRINTF("archive [%s] changed during verification", archive);
+            info->state = STATE_UNKNOWN;
+        }
+        else if (info && info->state == STATE_PENDING)
+        {
+            if (ok)
+            {
+                info->state = STATE_VERIFIED;
+                g_stats.verified++;
+                save_records();
+            }
+            else
+            {
+                info->state = STATE_FAILED;
+                g_stats.failed++;
+            }
+        }
+        g_static_mutex_unlock(&g_verify_mutex);
+
+        if (!ok)
+        {
+            // entries may have been served unchecked, don't keep them around
+            WARNPRINTF("archive [%s] failed verification", archive);
+            cache_invalidate_archive(archive, NULL);
+            spill_invalidate_archive(archive, NULL);
+        }
+
+        g_free(archive);
+    }
+
+    g_timer_destroy(timer);
+    return NULL;
+}
+
+
+// Decompress all entries of an archive, checking their CRCs
+static gboolean verify_archive(const gchar *archive, guint64 *bytes)
+{
+    unzFile  zip = unzOpen64(archive);
+    guchar   *buf = NULL;
+    gboolean ok   = TRUE;
+    int      err;
+    int      len;
+
+    if (zip == NULL)
+    {
+        WARNPRINTF("cannot open [%s]", archive);
+        return FALSE;
+    }
+
+    buf = g_malloc(READ_CHUNK);
+    for (err = unzGoToFirstFile(zip); err == UNZ_OK && ok; err = unzGoToNextFile(zip))
+    {
+        if (unzOpenCurrentFilePassword(zip, g_password) != UNZ_OK)
+        {
+            ok = FALSE;
+            break;
+        }
+        while ((len = unzReadCurrentFile(zip, buf, READ_CHUNK)) > 0)
+        {
+            *bytes += len;
+        }
+        if (unzCloseCurrentFile(zip) != UNZ_OK || len < 0)
+        {
+            ok = FALSE;
+        }
+    }
+    if (err != UNZ_END_OF_LIST_OF_FILE)
+    {
+        ok = FALSE;
+    }
+
+    g_free(buf);
+    unzClose(zip);
+
+    return ok;
+}
+
+
+// Find or create the state of an archive file with the given identity;
+// call with g_verify_mutex held
+static ArchiveInfo *get_info(const gchar *archive, guint64 size, gint64 mtime)
+{
+    ArchiveInfo *info = g_hash_table_lookup(g_archives, archive);
+
+    if (info == NULL)
+    {
+        info = g_new0(ArchiveInfo, 1);
+        info->size  = size;
+        info->mtime = mtime;
+        g_hash_table_insert(g_archives, g_strdup(archive), info);
+    }
+    else if (info->size != size || info->mtime != mtime)
+    {
+        // changed on disk since it was verified
+        if (info->state == STATE_VERIFIED)
+        {
+            g_stats.verified--;
+        }
+        else if (info->state == STATE_FAILED)
+        {
+            g_stats.failed--;
+        }
+        if (info->state != STATE_PENDING)
+        {
+            info->state = STATE_UNKNOWN;
+        }
+        info->size  = size;
+        info->mtime = mtime;
+    }
+
+    return info;
+}
+
+
+static gboolean stat_archive(const gchar *archive, guint64 *size, gint64 *mtime)
+{
+    struct stat st;
+
+    if (stat(archive, &st) != 0)
+    {
+        return FALSE;
+    }
+    *size  = st.st_size;
+    *mtime = st.st_mtime;
+    return TRUE;
+}
+
+
+// Read the record file, lines of "<size> <mtime> <path>";
+// call with g_verify_mutex held
+static void load_records(void)
+{
+    gchar  *contents = NULL;
+    gchar  **lines   = NULL;
+    gchar  **line    = NULL;
+
+    if (!g_file_get_contents(g_record_file, &contents, NULL, NULL))
+    {
+        return;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    for (line = lines; *line; line++)
+    {
+        ArchiveInfo *info  = NULL;
+        gchar       *end   = NULL;
+        guint64     size   = g_ascii_strtoull(*line, &end, 10);
+        gint64      mtime;
+
+        if (end == *line || *end != ' ')
+        {
+            continue;
+        }
+        mtime = (gint64) g_ascii_strtoull(end + 1, &end, 10);
+        if (*end != ' ' || end[1] == '\0')
+        {
+            continue;
+        }
+
+        info        = g_new0(ArchiveInfo, 1);
+        info->state = STATE_VERIFIED;
+        info->size  = size;
+        info->mtime = mtime;
+        g_hash_table_replace(g_archives, g_strdup(end + 1), info);
+        g_stats.verified++;
+    }
+
+    g_strfreev(lines);
+    g_free(contents);
+}
+
+
+// Write all verified archives to the record file;
+// call with g_verify_mutex held
+static void save_records(void)
+{
+    GString *text  = g_string_new("");
+    gchar   *dir   = NULL;
+    GError  *error = NULL;
+
+    g_hash_table_foreach(g_archives, &append_record, text);
+
+    dir = g_path_get_dirname(g_record_file);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    if (!g_file_set_contents(g_record_file, text->str, text->len, &error))
+    {
+        WARNPRINTF("cannot save [%s]: %s", g_record_file, error->message);
+        g_error_free(error);
+    }
+    g_string_free(text, TRUE);
+}
+
+
+static void append_record(gpointer key, gpointer value, gpointer user_data)
+{
+    const ArchiveInfo *info = value;
+
+    if (info->state == STATE_VERIFIED)
+    {
+        g_string_append_printf((GString *) user_data,
+                               "%" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %s\n",
+                               info->size, info->mtime, (const gchar *) key);
+    }
+}
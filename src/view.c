@@ -54,6 +54,8 @@
 #include "ipc.h"
 #include "menu.h"
 #include "metadata.h"
+#include "scheme.h"
+#include "server.h"
 
 
 //----------------------------------------------------------------------------
@@ -346,6 +348,7 @@ static gboolean is_local_file(const gchar *uri)
 static gboolean is_local_uri(const gchar *uri)
 {
     return uri && ( g_str_has_prefix(uri, "file://") ||
+                    g_str_has_prefix(uri, SCHEME_NAME "://") ||
                     g_str_has_prefix(uri, "http://localhost") ||
                     g_str_has_prefix(uri, "http://127.0.0.1") );
 }
@@ -526,6 +529,8 @@ static void go_back_cb(GtkWidget *item, BrowserWindow *window)
     erkeyb_client_hide(); // hide keyboard
 
     if (window->web_view) {
+      // before the new page is requested
+      server_cancel_reads();
       webkit_web_view_go_back(WEBKIT_WEB_VIEW(window->web_view));
     }
 }
@@ -538,6 +543,8 @@ static void go_forward_cb(GtkWidget *item, BrowserWindow *window)
     erkeyb_client_hide(); // hide keyboard
 
     if (window->web_view) {
+      // before the new page is requested
+      server_cancel_reads();
       webkit_web_view_go_forward(WEBKIT_WEB_VIEW(window->web_view));
     }
 }
@@ -566,6 +573,7 @@ static void stop_cb(GtkWidget *item, BrowserWindow *window)
 {
     LOGPRINTF("entry");
     webkit_web_view_stop_loading(WEBKIT_WEB_VIEW(window->web_view));
+    server_cancel_reads();
 }
 
 
@@ -891,6 +899,7 @@ static void load_started_cb(WebKitWebView *web_view, WebKitWebFrame *frame, Brow
         gtk_entry_set_text(GTK_ENTRY(window->uri_entry), g_browser->uri);
     }
     
+    server_set_loading(TRUE);
     show_busy(TRUE);
 }
 
@@ -909,6 +918,7 @@ static void load_finished_cb(WebKitWebView *web_view, WebKitWebFrame *frame, Bro
     if (hpos > 0.0) gtk_adjustment_set_value(g_browser->hadjustment, hpos);
     if (vpos > 0.0) gtk_adjustment_set_value(g_browser->vadjustment, vpos);
 */
+    server_set_loading(FALSE);
     show_busy(FALSE);
     g_page_loaded = TRUE;
 }
@@ -932,6 +942,7 @@ static gboolean load_error_cb(WebKitWebView  *web_view,
         load_error_page(window->uri, error);
     }
 
+    server_set_loading(FALSE);
     show_busy(FALSE);
 
     // stop error handling
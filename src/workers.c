@@ -0,0 +1,387 @@
+/*
+ * File Name: workers.c
+ */
+
+/*
+ * This file is part of erbrowser.
+ *
+ * erbrowser is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * erbrowser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Copyright (C) 2009 iRex Technologies B.V.
+ * All rights reserved.
+ */
+
+//----------------------------------------------------------------------------
+// Include Files
+//----------------------------------------------------------------------------
+
+#include "config.h"
+
+// system include files, between < >
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+// local include files, between " "
+#include "log.h"
+#include "workers.h"
+
+
+//----------------------------------------------------------------------------
+// Type Declarations
+//----------------------------------------------------------------------------
+
+typedef struct
+{
+    gpointer    job;
+    guint       priority;
+    gint64      queued;         // time queued, in microseconds
+} QueuedJob;
+
+typedef struct
+{
+    GMutex      *mutex;         // protects queues
+    GQueue      *queues[WORKERS_PRIORITIES];   // QueuedJob, oldest first
+    GThread     *thread;
+    gpointer    context;        // owned by the job function
+} Worker;
+
+
+//----------------------------------------------------------------------------
+// Static Variables
+//----------------------------------------------------------------------------
+
+static Worker           *g_workers     = NULL;
+static guint            g_count        = 0;
+static WorkerFunc       g_func         = NULL;
+static GDestroyNotify   g_context_free = NULL;
+
+// protect the fields below
+static GMutex           *g_idle_mutex  = NULL;
+static GCond            *g_idle_cond   = NULL;  // signalled when a job is queued
+static guint            g_next         = 0;     // queue for the next job
+static gboolean         g_stopping     = FALSE;
+static WorkerStats      g_stats;
+
+
+//============================================================================
+// Local Function Definitions
+//============================================================================
+
+static gpointer worker_thread   (gpointer data);
+static gpointer take_job        (guint self);
+static gint     get_rank        (const QueuedJob *queued, gint64 now);
+static gint64   get_time_us     (void);
+static guint    get_cpu_count   (void);
+
+
+//============================================================================
+// Functions Implementation
+//============================================================================
+
+gboolean workers_init(guint count, WorkerFunc func, GDestroyNotify context_free)
+{
+    guint i;
+    guint j;
+
+    g_return_val_if_fail(g_workers == NULL && func, FALSE);
+
+    if (count == 0)
+    {
+        count = get_cpu_count();
+    }
+    count = CLAMP(count, 1, WORKERS_MAX);
+    LOGPRINTF("count [%u]", count);
+
+    // the idle lock outlives the pool, so that a late submit can be refused
+    if (g_idle_mutex == NULL)
+    {
+        g_idle_mutex = g_mutex_new();
+        g_idle_cond  = g_cond_new();
+    }
+
+    g_func         = func;
+    g_context_free = context_free;
+    g_next         = 0;
+    g_stopping     = FALSE;
+    memset(&g_stats, 0, sizeof(g_stats));
+
+    g_count   = count;
+    g_workers = g_new0(Worker, count);
+    for (i = 0; i < count; i++)
+    {
+        g_workers[i].mutex = g_mutex_new();
+        for (j = 0; j < WORKERS_PRIORITIES; j++)
+        {
+            g_workers[i].queues[j] = g_queue_new();
+        }
+    }
+
+    // all queues exist before any thread may try to steal from them;
+    // the queue of a worker that failed to start is emptied by the others
+    for (i = 0; i < count; i++)
+    {
+        g_workers[i].thread = g_thread_create(&worker_thread, &g_workers[i], TRUE, NULL);
+        if (g_workers[i].thread == NULL)
+        {
+            ERRORPRINTF("cannot start worker [%u]", i);
+            continue;
+        }
+        g_stats.workers++;
+    }
+
+    if (g_stats.workers == 0)
+    {
+        workers_destroy();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+void workers_destroy(void)
+{
+    guint i;
+    guint j;
+
+    LOGPRINTF("entry");
+
+    if (g_workers == NULL)
+    {
+        return;
+    }
+
+    g_mutex_lock(g_idle_mutex);
+    g_stopping = TRUE;
+    g_cond_broadcast(g_idle_cond);
+    g_mutex_unlock(g_idle_mutex);
+
+    for (i = 0; i < g_count; i++)
+    {
+        if (g_workers[i].thread)
+        {
+            g_thread_join(g_workers[i].thread);
+        }
+    }
+
+    for (i = 0; i < g_count; i++)
+    {
+        for (j = 0; j < WORKERS_PRIORITIES; j++)
+        {
+            g_queue_free(g_workers[i].queues[j]);
+        }
+        g_mutex_free(g_workers[i].mutex);
+    }
+
+    g_mutex_lock(g_idle_mutex);
+    g_free(g_workers);
+    g_workers = NULL;
+    g_count   = 0;
+    g_mutex_unlock(g_idle_mutex);
+}
+
+
+gboolean workers_submit(gpointer job, guint priority)
+{
+    Worker    *worker = NULL;
+    QueuedJob *queued = NULL;
+
+    g_return_val_if_fail(job, FALSE);
+
+    if (g_idle_mutex == NULL)
+    {
+        return FALSE;
+    }
+
+    // queued and counted under g_idle_mutex, so that a worker taking the
+    // job cannot uncount it first
+    g_mutex_lock(g_idle_mutex);
+    if (g_workers == NULL || g_stopping)
+    {
+        g_mutex_unlock(g_idle_mutex);
+        return FALSE;
+    }
+
+    worker = &g_workers[g_next];
+    g_next = (g_next + 1) % g_count;
+
+    queued           = g_new(QueuedJob, 1);
+    queued->job      = job;
+    queued->priority = MIN(priority, WORKERS_PRIORITIES - 1);
+    queued->queued   = get_time_us();
+
+    g_mutex_lock(worker->mutex);
+    g_queue_push_tail(worker->queues[queued->priority], queued);
+    g_mutex_unlock(worker->mutex);
+
+    g_stats.pending++;
+    g_cond_signal(g_idle_cond);
+    g_mutex_unlock(g_idle_mutex);
+    return TRUE;
+}
+
+
+void workers_get_stats(WorkerStats *stats)
+{
+    g_return_if_fail(stats);
+
+    if (g_idle_mutex == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    g_mutex_lock(g_idle_mutex);
+    *stats = g_stats;
+    g_mutex_unlock(g_idle_mutex);
+}
+
+
+//============================================================================
+// Local Functions Implementation
+//============================================================================
+
+static gpointer worker_thread(gpointer data)
+{
+    Worker   *worker = data;
+    guint    self    = worker - g_workers;
+    gpointer job     = NULL;
+    gboolean stop    = FALSE;
+
+    while (!stop)
+    {
+        job = take_job(self);
+        if (job)
+        {
+            g_func(job, &worker->context);
+
+            g_mutex_lock(g_idle_mutex);
+            g_stats.jobs++;
+            g_mutex_unlock(g_idle_mutex);
+            continue;
+        }
+
+        g_mutex_lock(g_idle_mutex);
+        while (g_stats.pending == 0 && !g_stopping)
+        {
+            g_cond_wait(g_idle_cond, g_idle_mutex);
+        }
+        // queued jobs are still run, their submitters wait for them
+        stop = (g_stats.pending == 0);
+        g_mutex_unlock(g_idle_mutex);
+    }
+
+    if (g_context_free && worker->context)
+    {
+        g_context_free(worker->context);
+    }
+    worker->context = NULL;
+
+    return NULL;
+}
+
+
+// Take the job with the best rank of all queues, the oldest on a tie;
+// NULL when there is none, or another worker took it meanwhile
+static gpointer take_job(guint self)
+{
+    gint64    now       = get_time_us();
+    Worker    *best     = NULL;
+    guint     best_prio = 0;
+    gint      best_rank = G_MAXINT;
+    gint64    best_time = 0;
+    QueuedJob *queued   = NULL;
+    gpointer  job       = NULL;
+    guint     i;
+    guint     j;
+
+    for (i = 0; i < g_count; i++)
+    {
+        Worker *worker = &g_workers[(self + i) % g_count];
+
+        g_mutex_lock(worker->mutex);
+        for (j = 0; j < WORKERS_PRIORITIES; j++)
+        {
+            // the oldest job of a queue ranks best within it
+            queued = g_queue_peek_head(worker->queues[j]);
+            if (queued
+                && (get_rank(queued, now) < best_rank
+                    || (get_rank(queued, now) == best_rank && queued->queued < best_time)))
+            {
+                best      = worker;
+                best_prio = j;
+                best_rank = get_rank(queued, now);
+                best_time = queued->queued;
+            }
+        }
+        g_mutex_unlock(worker->mutex);
+    }
+
+    if (best == NULL)
+    {
+        return NULL;
+    }
+
+    g_mutex_lock(best->mutex);
+    queued = g_queue_pop_head(best->queues[best_prio]);
+    g_mutex_unlock(best->mutex);
+
+    if (queued)
+    {
+        job = queued->job;
+
+        g_mutex_lock(g_idle_mutex);
+        g_stats.pending--;
+        if (best != &g_workers[self])
+        {
+            g_stats.steals++;
+        }
+        if (get_rank(queued, now) < (gint) queued->priority)
+        {
+            g_stats.aged++;
+        }
+        g_mutex_unlock(g_idle_mutex);
+
+        g_free(queued);
+    }
+    return job;
+}
+
+
+// Priority of a queued job, raised by one for every WORKERS_AGING_US waited
+static gint get_rank(const QueuedJob *queued, gint64 now)
+{
+    gint64 aged = (now - queued->queued) / WORKERS_AGING_US;
+
+    return (gint) MAX((gint64) queued->priority - aged, 0);
+}
+
+
+static gint64 get_time_us(void)
+{
+    GTimeVal now;
+
+    g_get_current_time(&now);
+    return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+
+static guint get_cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? (guint) count : 1;
+}